@@ -9,65 +9,163 @@
 // DATE:        10/19/2019
 
 #include "config.h"
+#include "counter_random.h"
+#include "distance_kernels.h"
+#include "point_file.h"
+#include "point_stream.h"
+#include "points.h"
+#include "thread_pool.h"
+#include <algorithm>
 #include <vector>
-#include <valarray>
-#include <fstream>
 #include <iostream>
 #include <cmath>
+#include <limits>
+#include <memory>
 #include <random>
+#include <stdexcept>
 
 using std::vector;
-using std::valarray;
 using std::cout; using std::endl;
 
-typedef valarray<double> ValD;
+////////////////////////////////////////////////////////////////////////////////
+//
+// ENGINE
+// notes: LLOYD_ENGINE   measures the distance from every point to every mean
+//        HAMERLY_ENGINE keeps an upper bound on the distance of every point to
+//                       its mean and a lower bound on the distance to every
+//                       other mean, a point whose bounds are separated by
+//                       more than the means moved keeps its label without
+//                       measuring anything
+//        both label every point the same and find bit-identical means, the
+//        bounds carry rounding error so a point is only skipped when it clears
+//        its bound by BOUND_SLACK times the largest coordinate, and skipped
+//        points are rescanned with the same kernel arithmetic as Lloyd
+enum Engine { LLOYD_ENGINE, HAMERLY_ENGINE };
+
+const double BOUND_SLACK = 1e-9;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// SEEDING
+// notes: UNIFORM_SEEDING   draws every mean uniformly inside the bounding box
+//                          of the data, a mean can end up with no points
+//        PLUS_PLUS_SEEDING k-means++, every next mean is a point drawn with
+//                          probability proportional to its squared distance
+//                          to the closest mean so far
+//        PARALLEL_SEEDING  k-means||, each of SEEDING_ROUNDS rounds keeps
+//                          every point with probability OVERSAMPLING * d^2
+//                          over the sum of d^2, the candidates are weighted
+//                          by the points closest to them and cut down to K
+//                          means with k-means++
+//        the distance passes run across the thread pool in the same chunks
+//        as the assignment and k-means|| draws the coin of every point from
+//        counter_random.h, so the means never depend on the thread count
+enum Seeding { UNIFORM_SEEDING, PLUS_PLUS_SEEDING, PARALLEL_SEEDING };
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // CLUSTER
+// notes: each iteration splits the points into chunks of whole blocks, the
+//        threads label chunks and sum them into per chunk partial sums which
+//        are added up in chunk order afterwards, so the chunks and the order
+//        of every addition only depend on the number of points
+//        findClustersStreaming and addPoints are mini-batch k means, every
+//        point moves its closest mean 1 / n of the way towards it where n is
+//        the number of points that mean has absorbed so far, only the means
+//        and those counts are kept so no point is ever read twice by choice
+
+// partial sums and counts of one chunk, aligned and padded to whole 64 byte
+// cache lines so threads summing neighbouring chunks never write to one line
+struct alignas(64) ChunkTotals {
+	double sums[K * DIMENSIONS];
+	size_t counts[K];
+};
+
 class Cluster {
 public:
 	Cluster() : 
-		clusters_(vector<vector<ValD>>(K)),
-		means_(vector<ValD>(K, ValD(DIMENSIONS))) {}
+		data_(DIMENSIONS),
+		pool_(std::make_shared<ThreadPool>(THREADS)),
+		engine_(LLOYD_ENGINE),
+		seeding_(PLUS_PLUS_SEEDING),
+		means_(vector<double>(K * DIMENSIONS)),
+		sums_(vector<double>(K * DIMENSIONS)),
+		counts_(vector<size_t>(K)),
+		distances_(0),
+		absorbed_(vector<double>(K)) {}
 
 	// methods
-	void loadData      (string file = OUTPUT_FILE);
+	void setThreads    (size_t threads) { pool_ = std::make_shared<ThreadPool>(threads ? threads : 1); }
+	void setEngine     (Engine engine) { engine_ = engine; }
+	void setSeeding    (Seeding seeding) { seeding_ = seeding; }
+	void loadData      (string file = OUTPUT_FILE);  // maps a point file or parses a text file
+	void saveData      (const string& file) const;    // writes the data as a point file
 	void findClusters  ();
+	void findClustersStreaming (const string& file, size_t batchSize, size_t batches); // mini-batch k means over a file read batchSize points at a time
+	void addPoints     (const PointSet& points);                                      // moves the current means towards new points
 	void printMeans    () const;
 	void printClusters () const;
 
+	size_t distances () const { return distances_; } // point to mean distances measured by the last findClusters
+
 private:
 	// helper functions
-	void   initMeans ();
-	double distance  (const ValD& p1, const ValD& p2) const;
-	ValD   center    (int num)                        const;
+	void   initMeans   ();
+	void   seedUniform ();
+	void   seedPlusPlus (std::mt19937_64& generator);
+	void   seedParallel (std::mt19937_64& generator);
+	void   seedWeighted (const vector<double>& points, const vector<double>& weights,
+	                     std::mt19937_64& generator);                  // weighted k-means++ over a few points
+	double lowerDistances (const double* means, size_t count, vector<double>& dists,
+	                       vector<double>& chunkTotals);               // lowers dists to the closest of count means, returns their sum
+	size_t drawByDistance (const vector<double>& dists, const vector<double>& chunkTotals,
+	                       double target) const;                       // point at target of the running sum of dists
+	void   assign      ();       // labels every point with its closest mean and sums up every cluster
+	size_t labelAll    (size_t first, size_t last);         // labels blocks first .. last - 1, returns distances measured
+	size_t labelBounded(size_t first, size_t last);         // same, skipping points the bounds rule out
+	void   prepareBounds ();     // half the distance from every mean to its closest other mean
+	double updateMeans ();       // moves every mean to the center of its cluster, returns the largest squared shift
 
-	vector<ValD>         data_;
-	vector<vector<ValD>> clusters_; // vector of sets of points
-	vector<ValD>         means_;
+	PointSet         data_;
+	std::shared_ptr<ThreadPool> pool_;
+	Engine           engine_;
+	Seeding          seeding_;
+	vector<uint32_t> labels_; // cluster of every point
+	vector<double>   means_;  // K * DIMENSIONS, one mean per row
+	vector<double>   sums_;   // K * DIMENSIONS, sum of the points of every cluster
+	vector<size_t>   counts_; // number of points in every cluster
+	vector<ChunkTotals> chunkTotals_; // sums_ and counts_ of every chunk
+	vector<size_t>   chunkDistances_; // distances measured in every chunk
+	size_t           distances_;
+	vector<double>   absorbed_;    // points every mean has absorbed, sets the mini-batch learning rate
+	vector<uint32_t> batchLabels_; // closest mean of every point handed to addPoints
+
+	// HAMERLY_ENGINE state
+	vector<double>   upper_;     // upper bound on the distance of every point to its mean
+	vector<double>   lower_;     // lower bound on the distance of every point to any other mean
+	vector<double>   shifts_;    // distance every mean moved in the last update
+	vector<double>   halfGaps_;  // half the distance from every mean to the closest other mean
+	double           maxShift_;  // largest of shifts_
+	double           nextShift_; // second largest of shifts_
+	double           slack_;     // BOUND_SLACK times the largest coordinate
 };
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // CLUSTER functions
 ////////////////////////////////////////
-// loads all data from text file
+// loads all data, a point file is mapped in place and a text file is parsed
+// across the thread pool
 void Cluster::loadData(string file)
 {
-	std::ifstream in(file);
-	string num;
-	while (!in.eof())
-	{
-		ValD point(DIMENSIONS);
-		for (int i = 0; i < DIMENSIONS; ++i)
-		{
-			in >> num;
-			point[i] = stod(num);
-		}
-		
-		data_.push_back(point);
-	}
+	data_ = readPoints(file, DIMENSIONS, *pool_);
+}
+
+////////////////////////////////////////
+// writes the data to a point file that loadData maps instead of parsing
+void Cluster::saveData(const string& file) const
+{
+	writePoints(file, data_);
 }
 
 ////////////////////////////////////////
@@ -76,48 +174,279 @@ void Cluster::findClusters()
 {
 	initMeans();
 
-	// keep adjusting clusters until all means dont change by a set amount
-	int maxShift;
+	// keep adjusting clusters until all means dont change by a set amount,
+	// distances are compared squared so nothing is square rooted, every
+	// label starts as a real cluster so no bound or sum is read out of range
+	labels_.assign(data_.size(), 0);
+	distances_ = 0;
+	if (engine_ == HAMERLY_ENGINE)
+	{
+		// an infinite upper bound makes the first pass measure every point
+		upper_.assign(data_.size(), std::numeric_limits<double>::infinity());
+		lower_.assign(data_.size(), 0.0);
+		shifts_.assign(K, 0.0);
+		maxShift_ = nextShift_ = 0.0;
+
+		double largest = 0.0;
+		for (size_t i = 0; i != data_.size(); ++i)
+			for (int j = 0; j < DIMENSIONS; ++j)
+				largest = std::max(largest, std::fabs(data_.at(i, j)));
+		slack_ = BOUND_SLACK * largest;
+	}
+
+	double maxShift;
 	do {
-		// reset all cluster sets
-		clusters_ = vector<vector<ValD>>(K);
+		assign();
+		maxShift = updateMeans();
+	} while (MAX_MEAN_SHIFT * MAX_MEAN_SHIFT < maxShift);
 
-		// for all points, find closest mean/center
-		for (int i = 0; i < data_.size(); ++i)
-		{
-			int clusterNum = 0;
-			double minDist = distance(means_[0], data_[i]);
-			for (int j = 1; j < K; ++j)
-			{
-				double dist = distance(means_[j], data_[i]);
-				if (minDist > dist)
-				{
-					clusterNum = j; 
-					minDist = dist;
-				}
-			}
+	// every mean stands for its cluster if points are added later
+	std::copy(counts_.begin(), counts_.end(), absorbed_.begin());
+}
+
+////////////////////////////////////////
+// mini-batch k means, the means are seeded from the first batch of file and
+// then trained on batches of batchSize points, the file is started over
+// whenever it runs out, only the means are kept in memory
+void Cluster::findClustersStreaming(const string& file, size_t batchSize, size_t batches)
+{
+	PointStream stream(file, DIMENSIONS);
+	distances_ = 0;
+	stream.read(data_, batchSize);
+	initMeans();
+	data_.clear();
+	labels_.clear();
+	std::fill(absorbed_.begin(), absorbed_.end(), 0.0);
+
+	PointSet batch;
+	for (size_t i = 0; i != batches; ++i)
+	{
+		stream.read(batch, batchSize);
+		addPoints(batch);
+	}
+}
+
+////////////////////////////////////////
+// labels points with the current means across the thread pool, then moves
+// the closest mean of every point, in point order, 1 / absorbed of the way
+// towards it
+void Cluster::addPoints(const PointSet& points)
+{
+	const size_t blocks = points.blocks();
+	const size_t chunks = std::min(CHUNKS, blocks);
+	batchLabels_.resize(points.size());
 
-			// insert point into that cluster
-			clusters_[clusterNum].push_back(data_[i]);
+	const DistanceKernels& kernels = distanceKernels();
+	pool_->run(chunks, [&](size_t c) {
+		uint32_t labels[POINT_BLOCK];
+		double best[POINT_BLOCK];
+		for (size_t b = c * blocks / chunks; b != (c + 1) * blocks / chunks; ++b)
+		{
+			kernels.nearest(points.block(b), DIMENSIONS, &means_[0], K, labels, best);
+			const size_t lanes = std::min(POINT_BLOCK, points.size() - b * POINT_BLOCK);
+			std::copy(labels, labels + lanes, &batchLabels_[b * POINT_BLOCK]);
 		}
+	});
+
+	for (size_t i = 0; i != points.size(); ++i)
+	{
+		const uint32_t label = batchLabels_[i];
+		const double rate = 1.0 / ++absorbed_[label];
+		for (int j = 0; j < DIMENSIONS; ++j)
+			means_[label * DIMENSIONS + j] += rate * (points.at(i, j) - means_[label * DIMENSIONS + j]);
+	}
+	distances_ += points.size() * K;
+}
 
-		// store prev means to compare
-		vector<ValD> prevMeans = means_;
+////////////////////////////////////////
+// labels every point with its closest mean and sums up the points of every
+// cluster, see CLUSTER
+void Cluster::assign()
+{
+	const size_t blocks = data_.blocks();
+	const size_t chunks = std::min(CHUNKS, blocks);
+	chunkTotals_.clear();
+	chunkTotals_.resize(chunks);
+	chunkDistances_.assign(chunks, 0);
+	if (engine_ == HAMERLY_ENGINE)
+		prepareBounds();
 
-		// calc new means
+	pool_->run(chunks, [&](size_t c) {
+		const size_t first = c * blocks / chunks, last = (c + 1) * blocks / chunks;
+		if (engine_ == HAMERLY_ENGINE)
+			chunkDistances_[c] = labelBounded(first, last);
+		else
+			chunkDistances_[c] = labelAll(first, last);
+
+		// sum the chunk in point order, the same for every engine
+		double* sums = chunkTotals_[c].sums;
+		size_t* counts = chunkTotals_[c].counts;
+		for (size_t i = first * POINT_BLOCK; i != std::min(last * POINT_BLOCK, data_.size()); ++i)
+		{
+			++counts[labels_[i]];
+			for (int j = 0; j < DIMENSIONS; ++j)
+				sums[labels_[i] * DIMENSIONS + j] += data_.at(i, j);
+		}
+	});
+
+	// add up the chunks in order
+	std::fill(sums_.begin(), sums_.end(), 0.0);
+	std::fill(counts_.begin(), counts_.end(), 0);
+	for (size_t c = 0; c != chunks; ++c)
+	{
+		distances_ += chunkDistances_[c];
 		for (int i = 0; i < K; ++i)
-			means_[i] = center(i);
+		{
+			counts_[i] += chunkTotals_[c].counts[i];
+			for (int j = 0; j < DIMENSIONS; ++j)
+				sums_[i * DIMENSIONS + j] += chunkTotals_[c].sums[i * DIMENSIONS + j];
+		}
+	}
+}
+
+////////////////////////////////////////
+// labels the points of blocks first .. last - 1 with their closest mean,
+// returns the number of distances measured
+size_t Cluster::labelAll(size_t first, size_t last)
+{
+	const DistanceKernels& kernels = distanceKernels();
+	uint32_t labels[POINT_BLOCK];
+	double dists[POINT_BLOCK];
+	size_t measured = 0;
+	for (size_t b = first; b != last; ++b)
+	{
+		kernels.nearest(data_.block(b), DIMENSIONS, &means_[0], K, labels, dists);
+
+		// the last block may be partly empty
+		const size_t lanes = std::min(POINT_BLOCK, data_.size() - b * POINT_BLOCK);
+		std::copy(labels, labels + lanes, &labels_[b * POINT_BLOCK]);
+		measured += lanes * K;
+	}
+
+	return measured;
+}
+
+////////////////////////////////////////
+// labels the points of blocks first .. last - 1 like labelAll, but only
+// points whose bounds don't rule out a closer mean are measured, those are
+// gathered into a block of their own and rescanned together
+size_t Cluster::labelBounded(size_t first, size_t last)
+{
+	const DistanceKernels& kernels = distanceKernels();
+	double gathered[DIMENSIONS * POINT_BLOCK] = {};
+	size_t points[POINT_BLOCK]; // point in every lane of gathered
+	size_t lanes = 0;
+	size_t measured = 0;
+
+	// measures every mean for the gathered points, the closest two become
+	// the new bounds
+	auto rescan = [&]() {
+		uint32_t labels[POINT_BLOCK];
+		double best[POINT_BLOCK], second[POINT_BLOCK];
+		kernels.nearestTwo(gathered, DIMENSIONS, &means_[0], K, labels, best, second);
+		for (size_t l = 0; l != lanes; ++l)
+		{
+			labels_[points[l]] = labels[l];
+			upper_[points[l]] = std::sqrt(best[l]);
+			lower_[points[l]] = std::sqrt(second[l]);
+		}
+		measured += lanes * K;
+		lanes = 0;
+	};
+
+	for (size_t i = first * POINT_BLOCK; i != std::min(last * POINT_BLOCK, data_.size()); ++i)
+	{
+		// move the bounds by how far the means moved
+		const uint32_t label = labels_[i];
+		upper_[i] += shifts_[label];
+		lower_[i] -= shifts_[label] == maxShift_ ? nextShift_ : maxShift_;
+
+		// no other mean can be closer
+		const double bound = std::max(lower_[i], halfGaps_[label]);
+		if (upper_[i] + slack_ < bound)
+			continue;
+
+		// tighten the upper bound and try again
+		double dist = 0.0;
+		for (int j = 0; j < DIMENSIONS; ++j)
+		{
+			const double diff = data_.at(i, j) - means_[label * DIMENSIONS + j];
+			dist += diff * diff;
+		}
+		upper_[i] = std::sqrt(dist);
+		++measured;
+		if (upper_[i] + slack_ < bound)
+			continue;
+
+		// measure every mean
+		for (int j = 0; j < DIMENSIONS; ++j)
+			gathered[j * POINT_BLOCK + lanes] = data_.at(i, j);
+		points[lanes++] = i;
+		if (lanes == POINT_BLOCK)
+			rescan();
+	}
+	if (lanes != 0)
+		rescan();
 
-		// now find the max shift in means from prev
-		maxShift = distance(prevMeans[0], means_[0]);
-		for (int i = 1; i < K; ++i)
+	return measured;
+}
+
+////////////////////////////////////////
+// half the distance from every mean to its closest other mean, a point closer
+// than that to its own mean can't be closer to any other one
+void Cluster::prepareBounds()
+{
+	halfGaps_.assign(K, std::numeric_limits<double>::infinity());
+	for (int i = 0; i < K; ++i)
+		for (int j = i + 1; j < K; ++j)
 		{
-			double dist = distance(prevMeans[i], means_[i]);
-			if (maxShift < dist)
-				maxShift = dist;
+			const double half = std::sqrt(squaredDistance(&means_[i * DIMENSIONS], &means_[j * DIMENSIONS], DIMENSIONS)) / 2;
+			halfGaps_[i] = std::min(halfGaps_[i], half);
+			halfGaps_[j] = std::min(halfGaps_[j], half);
 		}
+	distances_ += K * (K - 1) / 2;
+}
+
+////////////////////////////////////////
+// moves every mean to the center of its cluster, a cluster that lost all of
+// its points keeps its mean, returns the largest squared shift of a mean
+double Cluster::updateMeans()
+{
+	double maxShift = 0.0;
+	if (engine_ == HAMERLY_ENGINE)
+		std::fill(shifts_.begin(), shifts_.end(), 0.0);
+	for (int i = 0; i < K; ++i)
+	{
+		if (counts_[i] == 0)
+			continue;
+
+		double mean[DIMENSIONS];
+		for (int j = 0; j < DIMENSIONS; ++j)
+			mean[j] = sums_[i * DIMENSIONS + j] / counts_[i];
+
+		double dist = squaredDistance(mean, &means_[i * DIMENSIONS], DIMENSIONS);
+		if (maxShift < dist)
+			maxShift = dist;
+		std::copy(mean, mean + DIMENSIONS, &means_[i * DIMENSIONS]);
+		if (engine_ == HAMERLY_ENGINE)
+			shifts_[i] = std::sqrt(dist);
+	}
 
-	} while (MAX_MEAN_SHIFT < maxShift);
+	// the bounds of a point move by the largest shift of any other mean
+	if (engine_ == HAMERLY_ENGINE)
+	{
+		maxShift_ = nextShift_ = 0.0;
+		for (int i = 0; i < K; ++i)
+			if (shifts_[i] > maxShift_)
+			{
+				nextShift_ = maxShift_;
+				maxShift_ = shifts_[i];
+			}
+			else if (shifts_[i] > nextShift_)
+				nextShift_ = shifts_[i];
+	}
+
+	return maxShift;
 }
 
 ////////////////////////////////////////
@@ -129,7 +458,7 @@ void Cluster::printMeans() const
 	for (int i = 0; i < K; ++i)
 	{
 		for (int j = 0; j < DIMENSIONS; ++j)
-			cout << means_[i][j] << ' ';
+			cout << means_[i * DIMENSIONS + j] << ' ';
 		cout << endl;
 	}
 }
@@ -143,33 +472,55 @@ void Cluster::printClusters() const
 		cout << endl << endl << "CLUSTER " << i << endl
 			<< "Mean: "; 
 		for (int j = 0; j < DIMENSIONS; ++j)
-			cout << means_[i][j] << ' ';
+			cout << means_[i * DIMENSIONS + j] << ' ';
 		cout << endl << endl;
 
 		cout << "Points:" << endl;
-		for (int a = 0; a < clusters_[i].size(); ++a)
+		for (size_t a = 0; a < labels_.size(); ++a)
 		{
+			if (labels_[a] != uint32_t(i))
+				continue;
+
 			for (int j = 0; j < DIMENSIONS; ++j)
-				cout << clusters_[i][a][j] << ' ';
+				cout << data_.at(a, j) << ' ';
 			cout << endl;
 		}
 	}
 }
 
 ////////////////////////////////////////
-// init cluster means
+// init cluster means, see SEEDING, throws if there are no points to seed from
 void Cluster::initMeans()
+{
+	if (data_.size() == 0)
+		throw std::runtime_error("can't seed clusters without any points");
+
+	std::mt19937_64 generator(SEED);
+	if (seeding_ == PLUS_PLUS_SEEDING)
+		seedPlusPlus(generator);
+	else if (seeding_ == PARALLEL_SEEDING)
+		seedParallel(generator);
+	else
+		seedUniform();
+
+	cout << "INITIAL ";
+	printMeans();
+}
+
+////////////////////////////////////////
+// draws every mean uniformly inside the bounding box of the data
+void Cluster::seedUniform()
 {
 	// find min and max of all dims of data
 	double min[DIMENSIONS], max[DIMENSIONS];
 	for (int j = 0; j < DIMENSIONS; ++j)
-		min[j] = max[j] = data_[0][j];
+		min[j] = max[j] = data_.at(0, j);
 
-	for (int i = 1; i < data_.size(); ++i)
+	for (size_t i = 1; i < data_.size(); ++i)
 		for (int j = 0; j < DIMENSIONS; ++j)
 		{
-			if (data_[i][j] < min[j]) min[j] = data_[i][j];
-			else if (data_[i][j] > max[j]) max[j] = data_[i][j];
+			if (data_.at(i, j) < min[j]) min[j] = data_.at(i, j);
+			else if (data_.at(i, j) > max[j]) max[j] = data_.at(i, j);
 		}
 
 	// after min and max of all dims found, randomly select a point for all k
@@ -179,31 +530,173 @@ void Cluster::initMeans()
 		std::uniform_real_distribution<double> distribution(min[j], max[j]);
 
 		for (int i = 0; i < K; ++i)
-			means_[i][j] = distribution(generator);
+			means_[i * DIMENSIONS + j] = distribution(generator);
 	}
+}
 
-	cout << "INITIAL ";
-	printMeans();
+////////////////////////////////////////
+// k-means++, the first mean is a random point and every next one a point
+// drawn with probability proportional to its squared distance to the
+// closest mean so far
+void Cluster::seedPlusPlus(std::mt19937_64& generator)
+{
+	vector<double> dists(data_.size(), std::numeric_limits<double>::infinity()), chunkTotals;
+	data_.copy(std::uniform_int_distribution<size_t>(0, data_.size() - 1)(generator), &means_[0]);
+	for (int i = 1; i < K; ++i)
+	{
+		const double total = lowerDistances(&means_[(i - 1) * DIMENSIONS], 1, dists, chunkTotals);
+		const double target = std::uniform_real_distribution<double>(0.0, total)(generator);
+		data_.copy(drawByDistance(dists, chunkTotals, target), &means_[i * DIMENSIONS]);
+	}
+}
+
+////////////////////////////////////////
+// k-means||, oversamples candidates in a few parallel rounds instead of K
+// sequential passes, then reduces the weighted candidates to K means
+void Cluster::seedParallel(std::mt19937_64& generator)
+{
+	const size_t blocks = data_.blocks();
+	const size_t chunks = std::min(CHUNKS, blocks);
+	vector<double> dists(data_.size(), std::numeric_limits<double>::infinity()), chunkTotals;
+
+	// start from one random point
+	vector<double> candidates(DIMENSIONS);
+	data_.copy(std::uniform_int_distribution<size_t>(0, data_.size() - 1)(generator), &candidates[0]);
+	double total = lowerDistances(&candidates[0], 1, dists, chunkTotals);
+
+	// every round keeps each point with probability OVERSAMPLING * d^2 / total
+	const uint64_t seed = generator();
+	vector<vector<size_t>> picked(chunks);
+	for (int round = 0; round < SEEDING_ROUNDS && total > 0.0; ++round)
+	{
+		pool_->run(chunks, [&](size_t c) {
+			picked[c].clear();
+			for (size_t i = c * blocks / chunks * POINT_BLOCK; i != std::min((c + 1) * blocks / chunks * POINT_BLOCK, data_.size()); ++i)
+				if (counterUniform(seed, round, i) * total < OVERSAMPLING * dists[i])
+					picked[c].push_back(i);
+		});
+
+		// add the picks in point order and measure them
+		const size_t before = candidates.size() / DIMENSIONS;
+		for (size_t c = 0; c != chunks; ++c)
+			for (size_t i : picked[c])
+			{
+				candidates.resize(candidates.size() + DIMENSIONS);
+				data_.copy(i, &candidates[candidates.size() - DIMENSIONS]);
+			}
+		const size_t added = candidates.size() / DIMENSIONS - before;
+		if (added != 0)
+			total = lowerDistances(&candidates[before * DIMENSIONS], added, dists, chunkTotals);
+	}
+
+	// weight every candidate by the number of points closest to it
+	const size_t count = candidates.size() / DIMENSIONS;
+	vector<uint32_t> closest(data_.size());
+	const DistanceKernels& kernels = distanceKernels();
+	pool_->run(chunks, [&](size_t c) {
+		uint32_t labels[POINT_BLOCK];
+		double best[POINT_BLOCK];
+		for (size_t b = c * blocks / chunks; b != (c + 1) * blocks / chunks; ++b)
+		{
+			kernels.nearest(data_.block(b), DIMENSIONS, &candidates[0], count, labels, best);
+			const size_t lanes = std::min(POINT_BLOCK, data_.size() - b * POINT_BLOCK);
+			std::copy(labels, labels + lanes, &closest[b * POINT_BLOCK]);
+		}
+	});
+	vector<double> weights(count, 0.0);
+	for (size_t i = 0; i != data_.size(); ++i)
+		++weights[closest[i]];
+
+	seedWeighted(candidates, weights, generator);
+}
+
+////////////////////////////////////////
+// k-means++ over a few weighted points, the chance of drawing a point is its
+// weight times its squared distance to the closest mean so far
+void Cluster::seedWeighted(const vector<double>& points, const vector<double>& weights, std::mt19937_64& generator)
+{
+	const size_t count = weights.size();
+	vector<double> dists(count, std::numeric_limits<double>::infinity()), chances = weights;
+	for (int i = 0; i < K; ++i)
+	{
+		// draw the next mean, every point is already a mean if nothing has a chance left
+		double total = 0.0;
+		for (size_t p = 0; p != count; ++p)
+			total += chances[p];
+		size_t chosen = 0;
+		if (total > 0.0)
+			chosen = std::discrete_distribution<size_t>(chances.begin(), chances.end())(generator);
+		std::copy(&points[chosen * DIMENSIONS], &points[chosen * DIMENSIONS] + DIMENSIONS, &means_[i * DIMENSIONS]);
+
+		for (size_t p = 0; p != count; ++p)
+		{
+			dists[p] = std::min(dists[p], squaredDistance(&points[p * DIMENSIONS], &means_[i * DIMENSIONS], DIMENSIONS));
+			chances[p] = weights[p] * dists[p];
+		}
+	}
 }
 
 ////////////////////////////////////////
-// calculates euclidean distance between two points
-double Cluster::distance(const ValD& p1, const ValD& p2) const
+// lowers the squared distance of every point in dists to the closest of count
+// means if that is closer, sums dists per chunk into chunkTotals and returns
+// their total, added up in chunk order
+double Cluster::lowerDistances(const double* means, size_t count, vector<double>& dists, vector<double>& chunkTotals)
 {
-	// eq for euclidean distance: sqrt((x_1 - y_1)^2 + (x_2 - y_2)^2...)
-	return sqrt(pow(p1 - p2, 2.0).sum());
+	const size_t blocks = data_.blocks();
+	const size_t chunks = std::min(CHUNKS, blocks);
+	chunkTotals.assign(chunks, 0.0);
+
+	const DistanceKernels& kernels = distanceKernels();
+	pool_->run(chunks, [&](size_t c) {
+		uint32_t labels[POINT_BLOCK];
+		double best[POINT_BLOCK];
+		double sum = 0.0;
+		for (size_t b = c * blocks / chunks; b != (c + 1) * blocks / chunks; ++b)
+		{
+			kernels.nearest(data_.block(b), DIMENSIONS, means, count, labels, best);
+			const size_t lanes = std::min(POINT_BLOCK, data_.size() - b * POINT_BLOCK);
+			for (size_t l = 0; l != lanes; ++l)
+			{
+				double& dist = dists[b * POINT_BLOCK + l];
+				dist = std::min(dist, best[l]);
+				sum += dist;
+			}
+		}
+		chunkTotals[c] = sum;
+	});
+
+	double total = 0.0;
+	for (size_t c = 0; c != chunks; ++c)
+		total += chunkTotals[c];
+
+	return total;
 }
 
 ////////////////////////////////////////
-// calculates center of cluster #
-ValD Cluster::center(int num) const
+// walks the running sum of dists to the point it passes target at, the
+// chunk is found from chunkTotals first so only one chunk is walked
+size_t Cluster::drawByDistance(const vector<double>& dists, const vector<double>& chunkTotals, double target) const
 {
-	ValD tmp(0.0, DIMENSIONS);
-	double size = clusters_[num].size();
-	for (int i = 0; i < size; ++i)
-		tmp = tmp + clusters_[num][i];
+	const size_t blocks = data_.blocks();
+	const size_t chunks = chunkTotals.size();
+	size_t c = 0;
+	for (; c + 1 < chunks && target >= chunkTotals[c]; ++c)
+		target -= chunkTotals[c];
+
+	// rounding can leave target just past the end, then the last point with
+	// any weight is taken
+	const size_t first = c * blocks / chunks * POINT_BLOCK;
+	size_t chosen = first;
+	for (size_t i = first; i != std::min((c + 1) * blocks / chunks * POINT_BLOCK, data_.size()); ++i)
+	{
+		if (target < dists[i])
+			return i;
+		target -= dists[i];
+		if (dists[i] > 0.0)
+			chosen = i;
+	}
 
-	return tmp / size;
+	return chosen;
 }
 
 
@@ -9,29 +9,135 @@
 // DATE:        10/19/2019
 
 #include "config.h"
+#include "counter_random.h"
+#include "point_file.h"
+#include "points.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <charconv>
 #include <fstream>
-#include <iostream>
-#include <random>
+#include <future>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
-using std::endl;
+using std::string;
 using std::vector;
 
-void testCluster(std::ofstream& out, const double min[], const double max[])
+////////////////////////////////////////////////////////////////////////////////
+//
+// TEST DATA
+// notes: the file holds AMOUNT points of every test cluster, cluster after
+//        cluster, coordinate d of point i of test cluster c is drawn uniformly
+//        in [MIN[c][d], MAX[c][d]) from counter_random.h stream c at counter
+//        i * DIMENSIONS + d, so every cluster gets its own random offsets and
+//        any range of points can be generated by any thread
+//        the threads each generate a chunk of GENERATE_BLOCKS blocks into
+//        their own buffer, the buffers are written in order by a writer
+//        thread while the next round of chunks is generated, so the file only
+//        depends on DATA_SEED and never on the number of threads
+//        TEXT_DATA  one point per line, shortest round trip decimals
+//        POINT_DATA a point file, see point_file.h
+enum DataFormat { TEXT_DATA, POINT_DATA };
+
+const size_t GENERATE_BLOCKS = 4096;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// TEST DATA functions
+////////////////////////////////////////
+// writes the coordinates of point i of the test cluster drawn from stream
+inline void testPoint(const double min[], const double max[], uint64_t stream, uint64_t i, double* point)
+{
+	for (int d = 0; d < DIMENSIONS; ++d)
+		point[d] = min[d] + counterUniform(DATA_SEED, stream, i * DIMENSIONS + d) * (max[d] - min[d]);
+}
+
+////////////////////////////////////////
+// writes the test points first .. last - 1 of the file as point file blocks,
+// first is a multiple of POINT_BLOCK
+void testBlocks(uint64_t first, uint64_t last, string& buffer)
+{
+	PointSet points(DIMENSIONS);
+	points.resize(size_t(last - first));
+
+	double point[DIMENSIONS];
+	for (uint64_t p = first; p != last; ++p)
+	{
+		const size_t cluster = size_t(p / AMOUNT);
+		testPoint(MIN[cluster], MAX[cluster], cluster, p % AMOUNT, point);
+		points.set(size_t(p - first), point);
+	}
+
+	buffer.assign(reinterpret_cast<const char*>(points.block(0)),
+	              points.blocks() * DIMENSIONS * POINT_BLOCK * sizeof(double));
+}
+
+////////////////////////////////////////
+// writes the test points first .. last - 1 of the file as lines of text
+void testText(uint64_t first, uint64_t last, string& buffer)
+{
+	buffer.clear();
+
+	double point[DIMENSIONS];
+	char number[32];
+	for (uint64_t p = first; p != last; ++p)
+	{
+		const size_t cluster = size_t(p / AMOUNT);
+		testPoint(MIN[cluster], MAX[cluster], cluster, p % AMOUNT, point);
+		for (int d = 0; d < DIMENSIONS; ++d)
+		{
+			buffer.append(number, std::to_chars(number, number + sizeof(number), point[d]).ptr);
+			buffer += d + 1 == DIMENSIONS ? '\n' : ' ';
+		}
+	}
+}
+
+////////////////////////////////////////
+// writes every test cluster to file across the pool
+void testData(const string& file, DataFormat format, ThreadPool& pool)
 {
-	// create distributions for all dimensions
-	std::default_random_engine generator;
-	vector<std::uniform_real_distribution<double>> distributions;
-	for (int j = 0; j < DIMENSIONS; ++j)
-		distributions.push_back(std::uniform_real_distribution<double>(min[j], max[j]));
+	std::ofstream out(file, std::ios::binary);
+	if (!out)
+		throw std::runtime_error("can't write " + file);
+
+	const uint64_t total = uint64_t(TEST_CLUSTERS) * AMOUNT;
+	const uint64_t chunkPoints = GENERATE_BLOCKS * POINT_BLOCK;
+	const uint64_t chunks = (total + chunkPoints - 1) / chunkPoints;
+	if (format == POINT_DATA)
+		writePointHeader(out, total, DIMENSIONS);
 
-	for (int i = 0; i < AMOUNT; ++i)
+	// a round is one chunk per thread, round r fills buffers[r % 2] while
+	// the writer is still busy with the other one
+	const size_t round = pool.size();
+	vector<string> buffers[2] = { vector<string>(round), vector<string>(round) };
+	std::future<void> writer;
+	for (uint64_t first = 0, r = 0; first < chunks; first += round, ++r)
 	{
-		for (int j = 0; j < DIMENSIONS; ++j)
-			out << distributions[j](generator) << ' ';
+		vector<string>& buffer = buffers[r % 2];
+		const size_t count = size_t(std::min<uint64_t>(round, chunks - first));
+		pool.run(count, [&](size_t t) {
+			const uint64_t begin = (first + t) * chunkPoints;
+			const uint64_t end = std::min(begin + chunkPoints, total);
+			if (format == POINT_DATA)
+				testBlocks(begin, end, buffer[t]);
+			else
+				testText(begin, end, buffer[t]);
+		});
 
-		out << endl;
+		if (writer.valid())
+			writer.get();
+		writer = std::async(std::launch::async, [&out, &buffer, count] {
+			for (size_t t = 0; t != count; ++t)
+				out.write(buffer[t].data(), buffer[t].size());
+		});
 	}
+	if (writer.valid())
+		writer.get();
+
+	out.close();
+	if (!out)
+		throw std::runtime_error("can't write " + file);
 }
 
-#endif GENERATOR_H
\ No newline at end of file
+#endif GENERATOR_H
@@ -17,8 +17,11 @@ using std::string;
 // TEST DATA PARAMETERS
 
 const string OUTPUT_FILE = "testData.txt";
+const string POINT_FILE = "testData.points"; // binary test data, mapped instead of parsed
+const bool BINARY_DATA = true; // write the test data to POINT_FILE instead of OUTPUT_FILE
+const unsigned DATA_SEED = 7; // seeds the test data, the same seed always writes the same file
 const int TEST_CLUSTERS = 2;
-const int AMOUNT = 30; // data generated per test cluster
+const size_t AMOUNT = 30; // data generated per test cluster
 const int DIMENSIONS = 2;
 const double MIN[TEST_CLUSTERS][DIMENSIONS] = { {0,3}, {3,3} };
 const double MAX[TEST_CLUSTERS][DIMENSIONS] = { {2,5}, {5,5} };
@@ -29,5 +32,16 @@ const double MAX[TEST_CLUSTERS][DIMENSIONS] = { {2,5}, {5,5} };
 
 const int K = 2; // num of clusters to find
 const double MAX_MEAN_SHIFT = .5; // keep adjusting means until they shift within this amount
+const unsigned SEED = 1; // seeds the initial means
+const bool SCALABLE_SEEDING = false; // seed with k-means|| instead of k-means++, for very large data
+const double OVERSAMPLING = 2.0 * K; // candidates k-means|| expects to keep every round
+const int SEEDING_ROUNDS = 5; // rounds of k-means|| candidate sampling
+const bool MINI_BATCH = false; // stream the data from disk in mini batches instead of loading all of it
+const size_t MINI_BATCH_SIZE = 1024; // points per mini batch
+const size_t MINI_BATCHES = 100; // mini batches to train on, the file is reread as often as needed
+const bool HAMERLY = true; // skip distances that triangle inequality bounds rule out, finds the same clusters
+const size_t THREADS = 4; // threads the points are split across
+const size_t CHUNKS = 256; // points are summed in at most this many chunks, added up in order so
+                           // the means don't depend on the number of threads
 
 #endif CONFIG_H
\ No newline at end of file
@@ -0,0 +1,47 @@
+#ifndef COUNTER_RANDOM_H
+#define COUNTER_RANDOM_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// FILE:        counter_random.h
+// DESCRIPTION: contains a counter based random number generator, every number
+//              is a hash of its seed, stream and position so any thread can
+//              draw any of them without sharing generator state
+// AUTHOR:      Dan Fabian
+// DATE:        10/19/2019
+
+#include <cstdint>
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// COUNTER RANDOM
+// notes: the hash is the splitmix64 finalizer applied once per input word,
+//        which is enough to make neighbouring counters look independent
+//        counterRandom  (seed, stream, counter) returns 64 random bits
+//        counterUniform (seed, stream, counter) returns a double in [0, 1)
+
+////////////////////////////////////////
+// splitmix64 finalizer
+inline uint64_t mix64(uint64_t z)
+{
+	z += 0x9E3779B97F4A7C15ull;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+////////////////////////////////////////
+// 64 random bits at position counter of stream
+inline uint64_t counterRandom(uint64_t seed, uint64_t stream, uint64_t counter)
+{
+	return mix64(mix64(mix64(seed) ^ stream) ^ counter);
+}
+
+////////////////////////////////////////
+// random double in [0, 1) at position counter of stream
+inline double counterUniform(uint64_t seed, uint64_t stream, uint64_t counter)
+{
+	return double(counterRandom(seed, stream, counter) >> 11) * (1.0 / 9007199254740992.0); // 53 bits / 2^53
+}
+
+#endif // COUNTER_RANDOM_H
@@ -0,0 +1,334 @@
+#ifndef DISTANCE_KERNELS_H
+#define DISTANCE_KERNELS_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// FILE:        distance_kernels.h
+// DESCRIPTION: contains the point to mean distance loops of k means with
+//              scalar, AVX2 and AVX-512 versions, the best one is picked at
+//              runtime
+// AUTHOR:      Dan Fabian
+// DATE:        10/19/2019
+
+#include "points.h"
+#include <cstdint>
+#include <limits>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define KERNELS_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// gcc and clang only emit AVX instructions inside functions marked for them,
+// msvc emits whatever intrinsics it is given
+#if defined(__GNUC__)
+#define KERNEL_TARGET(isa) __attribute__((target(isa)))
+#else
+#define KERNEL_TARGET(isa)
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// DISTANCE KERNELS
+// notes: nearest finds, for every lane of one POINT_BLOCK block, the closest
+//        of k means stored row-major, k * dims doubles, writing its index to
+//        labels and the squared distance to best, ties go to the lower index
+//        nearestTwo also writes the squared distance to the second closest
+//        mean, its labels and best are exactly the ones nearest gives
+//        distances are never square rooted, the closest mean is the same
+//        every kernel keeps the lanes in registers and allocates nothing
+struct DistanceKernels {
+	void (*nearest)    (const double* block, size_t dims, const double* means, size_t k, uint32_t* labels, double* best);
+	void (*nearestTwo) (const double* block, size_t dims, const double* means, size_t k, uint32_t* labels, double* best,
+	                    double* second);
+	const char* name;
+};
+
+////////////////////////////////////////
+// squared euclidean distance between two points of dims coordinates
+inline double squaredDistance(const double* a, const double* b, size_t dims)
+{
+	double sum = 0.0;
+	for (size_t d = 0; d != dims; ++d)
+	{
+		const double diff = a[d] - b[d];
+		sum += diff * diff;
+	}
+
+	return sum;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// SCALAR kernels
+////////////////////////////////////////
+// closest mean of every lane of block
+void nearestScalar(const double* block, size_t dims, const double* means, size_t k, uint32_t* labels, double* best)
+{
+	for (size_t l = 0; l != POINT_BLOCK; ++l)
+	{
+		labels[l] = 0;
+		best[l] = std::numeric_limits<double>::infinity();
+	}
+
+	double sum[POINT_BLOCK];
+	for (size_t j = 0; j != k; ++j)
+	{
+		const double* mean = means + j * dims;
+		for (size_t l = 0; l != POINT_BLOCK; ++l)
+			sum[l] = 0.0;
+		for (size_t d = 0; d != dims; ++d)
+			for (size_t l = 0; l != POINT_BLOCK; ++l)
+			{
+				const double diff = block[d * POINT_BLOCK + l] - mean[d];
+				sum[l] += diff * diff;
+			}
+
+		for (size_t l = 0; l != POINT_BLOCK; ++l)
+			if (sum[l] < best[l])
+			{
+				best[l] = sum[l];
+				labels[l] = uint32_t(j);
+			}
+	}
+}
+
+////////////////////////////////////////
+// closest and second closest mean of every lane of block
+void nearestTwoScalar(const double* block, size_t dims, const double* means, size_t k, uint32_t* labels, double* best,
+	double* second)
+{
+	for (size_t l = 0; l != POINT_BLOCK; ++l)
+	{
+		labels[l] = 0;
+		best[l] = second[l] = std::numeric_limits<double>::infinity();
+	}
+
+	double sum[POINT_BLOCK];
+	for (size_t j = 0; j != k; ++j)
+	{
+		const double* mean = means + j * dims;
+		for (size_t l = 0; l != POINT_BLOCK; ++l)
+			sum[l] = 0.0;
+		for (size_t d = 0; d != dims; ++d)
+			for (size_t l = 0; l != POINT_BLOCK; ++l)
+			{
+				const double diff = block[d * POINT_BLOCK + l] - mean[d];
+				sum[l] += diff * diff;
+			}
+
+		for (size_t l = 0; l != POINT_BLOCK; ++l)
+			if (sum[l] < best[l])
+			{
+				second[l] = best[l];
+				best[l] = sum[l];
+				labels[l] = uint32_t(j);
+			}
+			else if (sum[l] < second[l])
+				second[l] = sum[l];
+	}
+}
+
+#ifdef KERNELS_X86
+////////////////////////////////////////////////////////////////////////////////
+//
+// AVX2 kernels
+// notes: a block is two registers of 4 lanes, labels are kept as doubles so
+//        they can be blended with the same compare mask as the distances
+////////////////////////////////////////
+// closest mean of every lane of block
+KERNEL_TARGET("avx2,fma")
+void nearestAvx2(const double* block, size_t dims, const double* means, size_t k, uint32_t* labels, double* best)
+{
+	__m256d best0 = _mm256_set1_pd(std::numeric_limits<double>::infinity()), best1 = best0;
+	__m256d label0 = _mm256_setzero_pd(), label1 = label0;
+	for (size_t j = 0; j != k; ++j)
+	{
+		const double* mean = means + j * dims;
+		__m256d sum0 = _mm256_setzero_pd(), sum1 = sum0;
+		for (size_t d = 0; d != dims; ++d)
+		{
+			const __m256d c = _mm256_set1_pd(mean[d]);
+			const __m256d diff0 = _mm256_sub_pd(_mm256_loadu_pd(block + d * POINT_BLOCK), c);
+			const __m256d diff1 = _mm256_sub_pd(_mm256_loadu_pd(block + d * POINT_BLOCK + 4), c);
+			sum0 = _mm256_fmadd_pd(diff0, diff0, sum0);
+			sum1 = _mm256_fmadd_pd(diff1, diff1, sum1);
+		}
+
+		const __m256d index = _mm256_set1_pd(double(j));
+		const __m256d closer0 = _mm256_cmp_pd(sum0, best0, _CMP_LT_OQ);
+		const __m256d closer1 = _mm256_cmp_pd(sum1, best1, _CMP_LT_OQ);
+		best0 = _mm256_blendv_pd(best0, sum0, closer0);
+		best1 = _mm256_blendv_pd(best1, sum1, closer1);
+		label0 = _mm256_blendv_pd(label0, index, closer0);
+		label1 = _mm256_blendv_pd(label1, index, closer1);
+	}
+
+	_mm256_storeu_pd(best, best0);
+	_mm256_storeu_pd(best + 4, best1);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(labels), _mm256_cvttpd_epi32(label0));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(labels + 4), _mm256_cvttpd_epi32(label1));
+}
+
+////////////////////////////////////////
+// closest and second closest mean of every lane of block
+KERNEL_TARGET("avx2,fma")
+void nearestTwoAvx2(const double* block, size_t dims, const double* means, size_t k, uint32_t* labels, double* best,
+	double* second)
+{
+	__m256d best0 = _mm256_set1_pd(std::numeric_limits<double>::infinity()), best1 = best0;
+	__m256d second0 = best0, second1 = best0;
+	__m256d label0 = _mm256_setzero_pd(), label1 = label0;
+	for (size_t j = 0; j != k; ++j)
+	{
+		const double* mean = means + j * dims;
+		__m256d sum0 = _mm256_setzero_pd(), sum1 = sum0;
+		for (size_t d = 0; d != dims; ++d)
+		{
+			const __m256d c = _mm256_set1_pd(mean[d]);
+			const __m256d diff0 = _mm256_sub_pd(_mm256_loadu_pd(block + d * POINT_BLOCK), c);
+			const __m256d diff1 = _mm256_sub_pd(_mm256_loadu_pd(block + d * POINT_BLOCK + 4), c);
+			sum0 = _mm256_fmadd_pd(diff0, diff0, sum0);
+			sum1 = _mm256_fmadd_pd(diff1, diff1, sum1);
+		}
+
+		// a new closest mean pushes the old one to second, otherwise the
+		// distance may still beat the second closest
+		const __m256d index = _mm256_set1_pd(double(j));
+		const __m256d closer0 = _mm256_cmp_pd(sum0, best0, _CMP_LT_OQ);
+		const __m256d closer1 = _mm256_cmp_pd(sum1, best1, _CMP_LT_OQ);
+		second0 = _mm256_blendv_pd(_mm256_min_pd(sum0, second0), best0, closer0);
+		second1 = _mm256_blendv_pd(_mm256_min_pd(sum1, second1), best1, closer1);
+		best0 = _mm256_blendv_pd(best0, sum0, closer0);
+		best1 = _mm256_blendv_pd(best1, sum1, closer1);
+		label0 = _mm256_blendv_pd(label0, index, closer0);
+		label1 = _mm256_blendv_pd(label1, index, closer1);
+	}
+
+	_mm256_storeu_pd(best, best0);
+	_mm256_storeu_pd(best + 4, best1);
+	_mm256_storeu_pd(second, second0);
+	_mm256_storeu_pd(second + 4, second1);
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(labels), _mm256_cvttpd_epi32(label0));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(labels + 4), _mm256_cvttpd_epi32(label1));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// AVX-512 kernels
+// notes: a block is exactly one register
+////////////////////////////////////////
+// closest mean of every lane of block
+KERNEL_TARGET("avx512f")
+void nearestAvx512(const double* block, size_t dims, const double* means, size_t k, uint32_t* labels, double* best)
+{
+	__m512d bestAll = _mm512_set1_pd(std::numeric_limits<double>::infinity());
+	__m512d label = _mm512_setzero_pd();
+	for (size_t j = 0; j != k; ++j)
+	{
+		const double* mean = means + j * dims;
+		__m512d sum = _mm512_setzero_pd();
+		for (size_t d = 0; d != dims; ++d)
+		{
+			const __m512d diff = _mm512_sub_pd(_mm512_loadu_pd(block + d * POINT_BLOCK), _mm512_set1_pd(mean[d]));
+			sum = _mm512_fmadd_pd(diff, diff, sum);
+		}
+
+		const __mmask8 closer = _mm512_cmp_pd_mask(sum, bestAll, _CMP_LT_OQ);
+		bestAll = _mm512_mask_mov_pd(bestAll, closer, sum);
+		label = _mm512_mask_mov_pd(label, closer, _mm512_set1_pd(double(j)));
+	}
+
+	_mm512_storeu_pd(best, bestAll);
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(labels), _mm512_cvttpd_epi32(label));
+}
+
+////////////////////////////////////////
+// closest and second closest mean of every lane of block
+KERNEL_TARGET("avx512f")
+void nearestTwoAvx512(const double* block, size_t dims, const double* means, size_t k, uint32_t* labels, double* best,
+	double* second)
+{
+	__m512d bestAll = _mm512_set1_pd(std::numeric_limits<double>::infinity()), secondAll = bestAll;
+	__m512d label = _mm512_setzero_pd();
+	for (size_t j = 0; j != k; ++j)
+	{
+		const double* mean = means + j * dims;
+		__m512d sum = _mm512_setzero_pd();
+		for (size_t d = 0; d != dims; ++d)
+		{
+			const __m512d diff = _mm512_sub_pd(_mm512_loadu_pd(block + d * POINT_BLOCK), _mm512_set1_pd(mean[d]));
+			sum = _mm512_fmadd_pd(diff, diff, sum);
+		}
+
+		const __mmask8 closer = _mm512_cmp_pd_mask(sum, bestAll, _CMP_LT_OQ);
+		secondAll = _mm512_mask_mov_pd(_mm512_min_pd(sum, secondAll), closer, bestAll);
+		bestAll = _mm512_mask_mov_pd(bestAll, closer, sum);
+		label = _mm512_mask_mov_pd(label, closer, _mm512_set1_pd(double(j)));
+	}
+
+	_mm512_storeu_pd(best, bestAll);
+	_mm512_storeu_pd(second, secondAll);
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(labels), _mm512_cvttpd_epi32(label));
+}
+
+////////////////////////////////////////
+// cpuid checks, the os also has to save the wider registers (xgetbv)
+bool cpuHasAvx2()
+{
+#if defined(__GNUC__)
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) return false;
+	__cpuidex(info, 1, 0);
+	bool fma = (info[2] & (1 << 12)) != 0, osxsave = (info[2] & (1 << 27)) != 0;
+	if (!fma || !osxsave || (_xgetbv(0) & 0x6) != 0x6) return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return false;
+#endif
+}
+
+bool cpuHasAvx512()
+{
+#if defined(__GNUC__)
+	return __builtin_cpu_supports("avx512f");
+#elif defined(_MSC_VER)
+	if (!cpuHasAvx2() || (_xgetbv(0) & 0xE6) != 0xE6) return false;
+	int info[4];
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 16)) != 0;
+#else
+	return false;
+#endif
+}
+#endif // KERNELS_X86
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// DISPATCH
+////////////////////////////////////////
+// returns the fastest kernels this cpu supports, chosen on first call
+const DistanceKernels& distanceKernels()
+{
+	static const DistanceKernels selected = [] {
+		DistanceKernels k = { nearestScalar, nearestTwoScalar, "scalar" };
+#ifdef KERNELS_X86
+		if (cpuHasAvx512())
+			k = { nearestAvx512, nearestTwoAvx512, "avx512" };
+		else if (cpuHasAvx2())
+			k = { nearestAvx2, nearestTwoAvx2, "avx2" };
+#endif
+		return k;
+	}();
+
+	return selected;
+}
+
+#endif // DISTANCE_KERNELS_H
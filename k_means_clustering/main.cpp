@@ -12,16 +12,27 @@
 int main()
 {
 	// create test data file
-	std::ofstream out(OUTPUT_FILE);
-	
-	// create clusters
-	for (int i = 0; i < TEST_CLUSTERS; ++i)
-		testCluster(out, MIN[i], MAX[i]);
+	const string file = BINARY_DATA ? POINT_FILE : OUTPUT_FILE;
+	{
+		ThreadPool pool(THREADS);
+		testData(file, BINARY_DATA ? POINT_DATA : TEXT_DATA, pool);
+	}
 
 	// find clusters
 	Cluster cluster;
-	cluster.loadData();
-	cluster.findClusters();
+	if (HAMERLY)
+		cluster.setEngine(HAMERLY_ENGINE);
+	if (SCALABLE_SEEDING)
+		cluster.setSeeding(PARALLEL_SEEDING);
+
+	if (MINI_BATCH)
+		cluster.findClustersStreaming(file, MINI_BATCH_SIZE, MINI_BATCHES);
+	else
+	{
+		cluster.loadData(file);
+		cluster.findClusters();
+		cout << endl << "DISTANCES MEASURED: " << cluster.distances() << endl;
+	}
 
 	// print
 	cout << endl;
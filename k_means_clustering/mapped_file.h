@@ -0,0 +1,115 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// FILE:        mapped_file.h
+// DESCRIPTION: contains a read only memory mapped file
+// AUTHOR:      Dan Fabian
+// DATE:        10/19/2019
+
+#include <stdexcept>
+#include <string>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using std::string;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// MAPPED FILE
+// notes: the whole file is mapped read only and shared, so every process that
+//        maps the same file reads the same page cache pages
+class MappedFile {
+public:
+	// constructor and destructor
+	explicit MappedFile(const string& file);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// methods
+	const char* data () const { return data_; }
+	size_t      size () const { return size_; }
+
+private:
+	const char* data_;
+	size_t      size_;
+#if defined(_WIN32)
+	HANDLE      file_;
+	HANDLE      mapping_;
+#endif
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// MAPPED FILE functions
+////////////////////////////////////////
+// constructor, maps file or throws if it can't be opened
+MappedFile::MappedFile(const string& file) :
+	data_(nullptr),
+	size_(0)
+{
+#if defined(_WIN32)
+	file_ = CreateFileA(file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file_ == INVALID_HANDLE_VALUE)
+		throw std::runtime_error("can't open " + file);
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(file_, &size);
+	size_ = size_t(size.QuadPart);
+
+	mapping_ = size_ ? CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+	if (size_ && !mapping_)
+	{
+		CloseHandle(file_);
+		throw std::runtime_error("can't map " + file);
+	}
+	if (mapping_)
+		data_ = static_cast<const char*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+#else
+	int fd = open(file.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("can't open " + file);
+
+	struct stat info;
+	fstat(fd, &info);
+	size_ = size_t(info.st_size);
+
+	if (size_)
+	{
+		void* mapped = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+		if (mapped == MAP_FAILED)
+		{
+			close(fd);
+			throw std::runtime_error("can't map " + file);
+		}
+		data_ = static_cast<const char*>(mapped);
+	}
+	close(fd); // the mapping keeps its own reference to the file
+#endif
+}
+
+////////////////////////////////////////
+// destructor, unmaps file
+MappedFile::~MappedFile()
+{
+#if defined(_WIN32)
+	if (data_) UnmapViewOfFile(data_);
+	if (mapping_) CloseHandle(mapping_);
+	CloseHandle(file_);
+#else
+	if (data_) munmap(const_cast<char*>(data_), size_);
+#endif
+}
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,237 @@
+#ifndef POINT_FILE_H
+#define POINT_FILE_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// FILE:        point_file.h
+// DESCRIPTION: contains the binary point file, which is memory mapped straight
+//              into a point set, and a multithreaded text point parser
+// AUTHOR:      Dan Fabian
+// DATE:        10/19/2019
+
+#include "mapped_file.h"
+#include "points.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+using std::string;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// POINT FILE
+// notes: binary layout, every value in native byte order
+//        char[8]   magic "KMPOINT"
+//        uint32    version
+//        uint32    points per block, POINT_BLOCK of the writer
+//        uint64    number of points
+//        uint64    dimensions
+//        zero padding up to POINT_HEADER_BYTES so blocks start on a cache line
+//        then the blocks exactly as PointSet stores them, the last one zero
+//        padded, so a mapped file is used in place without copying a point
+const char     POINT_MAGIC[8] = { 'K', 'M', 'P', 'O', 'I', 'N', 'T', '\0' };
+const uint32_t POINT_VERSION = 1;
+const size_t   POINT_HEADER_BYTES = 64;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// TEXT POINTS
+// notes: one point per line, coordinates separated by spaces, tabs or commas
+//        so whitespace files and csv files both parse, blank lines are skipped
+//        and a first line that isn't all numbers is taken as a csv header, a
+//        line of numbers is always a point and throws if it has the wrong width
+//        or a nan or infinite coordinate
+//        the file is mapped and split into chunks of about PARSE_CHUNK_BYTES
+//        that start on a line, the threads parse chunks with from_chars and
+//        the points are copied into the set in file order
+const size_t PARSE_CHUNK_BYTES = size_t(1) << 20;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// POINT FILE functions
+////////////////////////////////////////
+// true if file starts with the point file magic
+bool isPointFile(const string& file)
+{
+	std::ifstream in(file, std::ios::binary);
+	char magic[sizeof(POINT_MAGIC)];
+	return in.read(magic, sizeof(magic)) && memcmp(magic, POINT_MAGIC, sizeof(POINT_MAGIC)) == 0;
+}
+
+////////////////////////////////////////
+// writes the header of a point file of points points, the blocks follow
+void writePointHeader(std::ostream& out, uint64_t points, size_t dims)
+{
+	char header[POINT_HEADER_BYTES] = {};
+	uint32_t version[2] = { POINT_VERSION, uint32_t(POINT_BLOCK) };
+	uint64_t sizes[2] = { points, dims };
+	memcpy(header, POINT_MAGIC, sizeof(POINT_MAGIC));
+	memcpy(header + sizeof(POINT_MAGIC), version, sizeof(version));
+	memcpy(header + sizeof(POINT_MAGIC) + sizeof(version), sizes, sizeof(sizes));
+	out.write(header, sizeof(header));
+}
+
+////////////////////////////////////////
+// writes points to a point file
+void writePoints(const string& file, const PointSet& points)
+{
+	std::ofstream out(file, std::ios::binary);
+	if (!out)
+		throw std::runtime_error("can't write " + file);
+
+	writePointHeader(out, points.size(), points.dims());
+	if (points.size())
+		out.write(reinterpret_cast<const char*>(points.block(0)),
+		          points.blocks() * points.dims() * POINT_BLOCK * sizeof(double));
+	if (!out)
+		throw std::runtime_error("can't write " + file);
+}
+
+////////////////////////////////////////
+// maps a point file, the returned set views the blocks in the mapping, throws
+// if it isn't a complete point file of dims dimensions
+PointSet mapPoints(const string& file, size_t dims)
+{
+	std::shared_ptr<MappedFile> mapping = std::make_shared<MappedFile>(file);
+	const char* data = mapping->data();
+	if (mapping->size() < POINT_HEADER_BYTES || memcmp(data, POINT_MAGIC, sizeof(POINT_MAGIC)) != 0)
+		throw std::runtime_error(file + " is not a point file");
+
+	uint32_t version[2];
+	uint64_t sizes[2];
+	memcpy(version, data + sizeof(POINT_MAGIC), sizeof(version));
+	memcpy(sizes, data + sizeof(POINT_MAGIC) + sizeof(version), sizeof(sizes));
+	if (version[0] != POINT_VERSION || version[1] != POINT_BLOCK)
+		throw std::runtime_error(file + " has an unsupported point file version");
+	if (sizes[1] != dims)
+		throw std::runtime_error(file + " has points of the wrong dimension");
+
+	const size_t points = size_t(sizes[0]);
+	const size_t blocks = (points + POINT_BLOCK - 1) / POINT_BLOCK;
+	if ((mapping->size() - POINT_HEADER_BYTES) / sizeof(double) / POINT_BLOCK / std::max<size_t>(dims, 1) < blocks)
+		throw std::runtime_error(file + " is truncated");
+
+	PointSet set(dims);
+	set.view(mapping, reinterpret_cast<const double*>(data + POINT_HEADER_BYTES), points);
+	return set;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// TEXT POINTS functions
+////////////////////////////////////////
+// true for characters between coordinates
+inline bool isSeparator(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == ',';
+}
+
+////////////////////////////////////////
+// appends the coordinates of the line [first, last) to values, returns the
+// number of coordinates, -1 if something on the line isn't a number or -2 if
+// a number is nan or infinite, which from_chars reads but no point can hold
+long parseLine(const char* first, const char* last, vector<double>& values)
+{
+	long fields = 0;
+	while (true)
+	{
+		while (first != last && isSeparator(*first))
+			++first;
+		if (first == last)
+			return fields;
+
+		if (*first == '+') // from_chars only takes a minus sign
+			++first;
+		double value;
+		const std::from_chars_result result = std::from_chars(first, last, value);
+		if (result.ec != std::errc() || (result.ptr != last && !isSeparator(*result.ptr)))
+			return -1;
+		if (!std::isfinite(value))
+			return -2;
+
+		values.push_back(value);
+		first = result.ptr;
+		++fields;
+	}
+}
+
+////////////////////////////////////////
+// parses a text point file across the pool, throws on a line other than a
+// header that doesn't hold dims coordinates
+PointSet parsePoints(const string& file, size_t dims, ThreadPool& pool)
+{
+	MappedFile text(file);
+	const char* begin = text.data();
+	const char* end = begin + text.size();
+
+	// every chunk starts right after a newline
+	const size_t chunks = text.size() / PARSE_CHUNK_BYTES + 1;
+	vector<const char*> starts(chunks + 1, end);
+	starts[0] = begin;
+	for (size_t c = 1; c != chunks; ++c)
+	{
+		const char* newline = std::find(begin + c * text.size() / chunks - 1, end, '\n');
+		starts[c] = newline == end ? end : newline + 1;
+	}
+
+	// parse every chunk on its own, errors are kept as the byte offset of the
+	// bad line so the first one in the file is reported, not the first thrown
+	vector<vector<double>> values(chunks);
+	vector<size_t> errors(chunks, text.size());
+	pool.run(chunks, [&](size_t c) {
+		const char* line = starts[c];
+		while (line != starts[c + 1])
+		{
+			const char* eol = std::find(line, starts[c + 1], '\n');
+			const size_t mark = values[c].size();
+			const long fields = parseLine(line, eol, values[c]);
+			if (fields != 0 && fields != long(dims))
+			{
+				values[c].resize(mark);
+				if (line != begin || fields != -1) // anything but a header
+				{
+					errors[c] = size_t(line - begin);
+					return;
+				}
+			}
+			line = eol == starts[c + 1] ? eol : eol + 1;
+		}
+	});
+
+	for (size_t c = 0; c != chunks; ++c)
+		if (errors[c] != text.size())
+			throw std::runtime_error(file + " has a malformed point at byte " + std::to_string(errors[c]));
+
+	// copy the points in file order, every chunk to its own range
+	vector<size_t> firsts(chunks + 1, 0);
+	for (size_t c = 0; c != chunks; ++c)
+		firsts[c + 1] = firsts[c] + values[c].size() / dims;
+
+	PointSet points(dims);
+	points.resize(firsts[chunks]);
+	pool.run(chunks, [&](size_t c) {
+		for (size_t i = firsts[c]; i != firsts[c + 1]; ++i)
+			points.set(i, &values[c][(i - firsts[c]) * dims]);
+		vector<double>().swap(values[c]);
+	});
+
+	return points;
+}
+
+////////////////////////////////////////
+// maps a point file or parses a text file, whichever file is
+PointSet readPoints(const string& file, size_t dims, ThreadPool& pool)
+{
+	if (isPointFile(file))
+		return mapPoints(file, dims);
+	return parsePoints(file, dims, pool);
+}
+
+#endif // POINT_FILE_H
@@ -0,0 +1,142 @@
+#ifndef POINT_STREAM_H
+#define POINT_STREAM_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// FILE:        point_stream.h
+// DESCRIPTION: contains a reader that hands out the points of a text or point
+//              file a batch at a time, so files larger than memory can be
+//              clustered
+// AUTHOR:      Dan Fabian
+// DATE:        10/19/2019
+
+#include "point_file.h"
+#include "points.h"
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using std::string;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// POINT STREAM
+// notes: a text file is read a line at a time and follows the same rules as
+//        parsePoints, a point per line, blank lines and a csv header skipped,
+//        any other line that isn't dims coordinates throws
+//        a point file is mapped and its points are copied out in order, the
+//        os pages the file in and out so it can be larger than memory
+//        reading past the end of the file starts over at the beginning, so a
+//        batch can hold the last points of one pass and the first of the next
+class PointStream {
+public:
+	// constructor
+	PointStream(const string& file, size_t dims);
+
+	// methods
+	size_t read   (PointSet& batch, size_t count); // replaces batch with the next count points, returns count
+	size_t passes () const { return passes_; }     // times the end of the file was reached
+
+private:
+	bool readPoint (double* point); // false at the end of the file, throws on a malformed point
+
+	std::ifstream  in_;
+	string         line_;   // current line of a text file
+	vector<double> values_; // coordinates parsed from line_
+	size_t         offset_; // byte of the text file the next line starts at
+	PointSet       mapped_; // points of a point file, empty for a text file
+	size_t         next_;   // next point of mapped_ to hand out
+	string         file_;
+	size_t         dims_;
+	size_t         passes_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// POINT STREAM functions
+////////////////////////////////////////
+// constructor, throws if file can't be opened
+PointStream::PointStream(const string& file, size_t dims) :
+	offset_(0),
+	mapped_(dims),
+	next_(0),
+	file_(file),
+	dims_(dims),
+	passes_(0)
+{
+	if (isPointFile(file))
+	{
+		mapped_ = mapPoints(file, dims);
+		return;
+	}
+
+	in_.open(file, std::ios::binary); // offsets count bytes the way parsePoints does
+	if (!in_)
+		throw std::runtime_error("can't open " + file);
+}
+
+////////////////////////////////////////
+// replaces batch with the next count points, throws if the file has none
+size_t PointStream::read(PointSet& batch, size_t count)
+{
+	batch = PointSet(dims_);
+	batch.reserve(count);
+
+	vector<double> point(dims_);
+	bool rewound = false; // no point has been read since the last rewind
+	while (batch.size() != count)
+	{
+		if (readPoint(&point[0]))
+		{
+			batch.add(&point[0]);
+			rewound = false;
+			continue;
+		}
+
+		if (rewound)
+			throw std::runtime_error(file_ + " has no points");
+		in_.clear();
+		in_.seekg(0);
+		offset_ = 0;
+		next_ = 0;
+		++passes_;
+		rewound = true;
+	}
+
+	return count;
+}
+
+////////////////////////////////////////
+// reads the coordinates of the next point, false at the end of the file,
+// throws on a line that parsePoints would reject
+bool PointStream::readPoint(double* point)
+{
+	if (mapped_.mapped())
+	{
+		if (next_ == mapped_.size())
+			return false;
+		mapped_.copy(next_++, point);
+		return true;
+	}
+
+	while (std::getline(in_, line_))
+	{
+		const size_t start = offset_;
+		offset_ += line_.size() + 1;
+		values_.clear();
+		const long fields = parseLine(line_.data(), line_.data() + line_.size(), values_);
+		if (fields == long(dims_))
+		{
+			std::copy(values_.begin(), values_.end(), point);
+			return true;
+		}
+		if (fields != 0 && (start != 0 || fields != -1)) // anything but a blank line or a header
+			throw std::runtime_error(file_ + " has a malformed point at byte " + std::to_string(start));
+	}
+
+	return false;
+}
+
+#endif // POINT_STREAM_H
@@ -0,0 +1,144 @@
+#ifndef POINTS_H
+#define POINTS_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// FILE:        points.h
+// DESCRIPTION: contains the contiguous blocked storage of a set of points
+// AUTHOR:      Dan Fabian
+// DATE:        10/19/2019
+
+#include "mapped_file.h"
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+using std::vector;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// POINT SET
+// notes: points are stored in blocks of POINT_BLOCK, each block dimension
+//        major so one coordinate of all the block's points is contiguous
+//        and a distance kernel handles the whole block with one vector
+//        register per dimension
+//        point i, dimension d is at ((i / POINT_BLOCK * dims + d) * POINT_BLOCK + i % POINT_BLOCK)
+//        unused lanes of the last block are zero
+//        a set can view blocks in a mapped point file instead of owning them,
+//        changing a viewing set copies the blocks into the set first
+const size_t POINT_BLOCK = 8;
+
+class PointSet {
+public:
+	// constructor
+	explicit PointSet(size_t dims = 0) : mapped_(nullptr), dims_(dims), size_(0) {}
+
+	// methods
+	void   add     (const double* point);   // appends a point of dims coordinates
+	void   set     (size_t i, const double* point); // overwrites point i
+	void   resize  (size_t points);         // new points are zero
+	void   reserve (size_t points);
+	void   clear   () { coords_.clear(); mapping_.reset(); mapped_ = nullptr; size_ = 0; }
+	void   view    (std::shared_ptr<MappedFile> mapping, const double* coords, size_t points); // views points blocks at coords
+	double at      (size_t i, size_t d) const { return coords()[offset(i, d)]; }
+	void   copy    (size_t i, double* point) const;  // writes the dims coordinates of point i
+	size_t size    () const { return size_; }
+	size_t dims    () const { return dims_; }
+	size_t blocks  () const { return (size_ + POINT_BLOCK - 1) / POINT_BLOCK; }
+	bool   mapped  () const { return mapping_ != nullptr; }
+
+	const double* block (size_t b) const { return coords() + b * dims_ * POINT_BLOCK; } // dims * POINT_BLOCK coordinates
+
+private:
+	// helper functions
+	size_t        offset (size_t i, size_t d) const { return (i / POINT_BLOCK * dims_ + d) * POINT_BLOCK + i % POINT_BLOCK; }
+	const double* coords () const { return mapping_ ? mapped_ : coords_.data(); }
+	void          detach ();            // copies viewed blocks into coords_
+
+	vector<double>              coords_;
+	std::shared_ptr<MappedFile> mapping_; // file the viewed blocks live in, null when coords_ is used
+	const double*               mapped_;
+	size_t                      dims_;
+	size_t                      size_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// POINT SET functions
+////////////////////////////////////////
+// appends a point, a new zeroed block is started every POINT_BLOCK points
+void PointSet::add(const double* point)
+{
+	detach();
+	if (size_ % POINT_BLOCK == 0)
+		coords_.resize(coords_.size() + dims_ * POINT_BLOCK, 0.0);
+
+	for (size_t d = 0; d != dims_; ++d)
+		coords_[offset(size_, d)] = point[d];
+	++size_;
+}
+
+////////////////////////////////////////
+// overwrites point i of a set that owns its blocks, different points can be
+// set from different threads at once
+void PointSet::set(size_t i, const double* point)
+{
+	for (size_t d = 0; d != dims_; ++d)
+		coords_[offset(i, d)] = point[d];
+}
+
+////////////////////////////////////////
+// changes the number of points, lanes past the new size are zeroed so the
+// last block keeps its zero padding
+void PointSet::resize(size_t points)
+{
+	detach();
+	const size_t blocks = (points + POINT_BLOCK - 1) / POINT_BLOCK;
+	coords_.resize(blocks * dims_ * POINT_BLOCK, 0.0);
+	for (size_t i = points; i < std::min(size_, blocks * POINT_BLOCK); ++i)
+		for (size_t d = 0; d != dims_; ++d)
+			coords_[offset(i, d)] = 0.0;
+	size_ = points;
+}
+
+////////////////////////////////////////
+// writes the coordinates of point i
+void PointSet::copy(size_t i, double* point) const
+{
+	const double* data = coords();
+	for (size_t d = 0; d != dims_; ++d)
+		point[d] = data[offset(i, d)];
+}
+
+////////////////////////////////////////
+// reserves room for points without reallocating
+void PointSet::reserve(size_t points)
+{
+	coords_.reserve((points + POINT_BLOCK - 1) / POINT_BLOCK * POINT_BLOCK * dims_);
+}
+
+////////////////////////////////////////
+// views points blocks at coords, mapping keeps them alive
+void PointSet::view(std::shared_ptr<MappedFile> mapping, const double* coords, size_t points)
+{
+	coords_.clear();
+	coords_.shrink_to_fit();
+	mapping_ = mapping;
+	mapped_ = coords;
+	size_ = points;
+}
+
+////////////////////////////////////////
+// copies viewed blocks into coords_ so they can be changed
+void PointSet::detach()
+{
+	if (!mapping_)
+		return;
+
+	coords_.assign(mapped_, mapped_ + blocks() * dims_ * POINT_BLOCK);
+	mapping_.reset();
+	mapped_ = nullptr;
+}
+
+#endif // POINTS_H
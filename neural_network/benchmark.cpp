@@ -0,0 +1,77 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// FILE:        benchmark.cpp
+// DESCRIPTION: measures inference throughput and latency of predict for a
+//              range of batch sizes, in double, float and int8
+// AUTHOR:      Dan Fabian
+// DATE:        10/20/2019
+
+#include "config.h"
+#include "quantized_network.h"
+#include "fixed_network.h"
+#include <chrono>
+
+typedef std::chrono::steady_clock Clock;
+
+////////////////////////////////////////
+// times BENCHMARK_REQUESTS predict calls of model for every batch size
+template <typename Model>
+void benchmark(const string& name, const Model& model)
+{
+	// set up random generator
+	std::default_random_engine generator;
+	std::uniform_real_distribution<double> distribution(0.0, 1.0);
+	auto rand = std::bind(distribution, generator);
+
+	cout << name << endl << "batch\tsamples/sec\tp50 (us)\tp99 (us)" << endl;
+	for (size_t b = 0; b != BENCHMARK_BATCH_SIZES.size(); ++b)
+	{
+		const size_t batchSize = BENCHMARK_BATCH_SIZES[b];
+		valarray<ValD> X(ValD(INPUTS), batchSize);
+		for (size_t i = 0; i != X.size(); ++i)
+			for (size_t j = 0; j != INPUTS; ++j)
+				X[i][j] = rand();
+
+		// warm up caches and the thread pool
+		model.predict(X);
+
+		// time every call separately to get the latency distribution
+		vector<double> latencies(BENCHMARK_REQUESTS);
+		Clock::time_point start = Clock::now();
+		for (size_t r = 0; r != BENCHMARK_REQUESTS; ++r)
+		{
+			Clock::time_point begin = Clock::now();
+			model.predict(X);
+			latencies[r] = std::chrono::duration<double, std::micro>(Clock::now() - begin).count();
+		}
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+		std::sort(latencies.begin(), latencies.end());
+		double p50 = latencies[latencies.size() / 2];
+		double p99 = latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)];
+
+		cout << batchSize << '\t' << batchSize * BENCHMARK_REQUESTS / seconds << "\t\t"
+			<< p50 << "\t\t" << p99 << endl;
+	}
+	cout << endl;
+}
+
+int main()
+{
+	// set up networks, weights are untrained since only speed matters here
+	Network net(BENCHMARK_LAYERS_SIZES, STEP_CONSTANT, LAMBDA);
+	NetworkF netF(BENCHMARK_LAYERS_SIZES, STEP_CONSTANT, LAMBDA);
+	QuantizedNetwork quant(net);
+	FixedNetwork<INPUTS, 64, 64, OUTPUTS> fixed(net); // has to match BENCHMARK_LAYERS_SIZES
+	net.setThreads(BENCHMARK_THREADS);
+	netF.setThreads(BENCHMARK_THREADS);
+	quant.setThreads(BENCHMARK_THREADS);
+
+	cout << "kernels: " << kernels<double>().name << ", int8 kernels: " << int8Kernels().name
+		<< ", threads: " << BENCHMARK_THREADS << endl << endl;
+
+	benchmark("DOUBLE", net);
+	benchmark("FLOAT", netF);
+	benchmark("INT8", quant);
+	benchmark("FIXED (single thread)", fixed);
+}
@@ -8,8 +8,10 @@
 // AUTHOR:      Dan Fabian
 // DATE:        10/20/2019
 
+#include <string>
 #include <vector>
 
+using std::string;
 using std::vector;
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -29,5 +31,37 @@ const vector<size_t> LAYERS_SIZES = { INPUTS, OUTPUTS };
 const double STEP_CONSTANT = .12;
 const double LAMBDA = 1;
 const size_t TRAINING_EPOCHS = 20;
+const size_t BATCH_SIZE = 10; // samples per epoch, 1 trains one sample at a time
+const size_t TRAINING_THREADS = 4; // threads each batch is split across
+const bool SOFTMAX_OUTPUTS = true; // one softmax over the outputs instead of independent sigmoids
+const string MODEL_FILE = "network.model"; // trained network is saved here, load with Network::load
+const string TRAIN_DATA_FILE = "train.data"; // training samples are written here and streamed back while training
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// EARLY STOPPING PARAMETERS
+
+const size_t VALIDATION_DATA_SIZE = 100; // held out samples the loss is checked on while training
+const size_t VALIDATION_INTERVAL = 2; // epochs between validation checks
+const size_t VALIDATION_PATIENCE = 3; // checks without improvement before training stops
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// PROFILING PARAMETERS
+
+// uncomment, or build with -DNETWORK_PROFILING, to time every training phase
+// and write a per epoch summary, without it the profiler isn't compiled at all
+// #define NETWORK_PROFILING
+const string TELEMETRY_CSV_FILE = "telemetry.csv";
+const string TELEMETRY_JSON_FILE = "telemetry.json";
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// BENCHMARK PARAMETERS
+
+const vector<size_t> BENCHMARK_LAYERS_SIZES = { INPUTS, 64, 64, OUTPUTS };
+const vector<size_t> BENCHMARK_BATCH_SIZES = { 1, 8, 64, 512, 4096 };
+const size_t BENCHMARK_REQUESTS = 200; // predict calls timed per batch size
+const size_t BENCHMARK_THREADS = 4;
 
 #endif CONFIG_H
\ No newline at end of file
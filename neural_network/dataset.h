@@ -0,0 +1,326 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// FILE:        dataset.h
+// DESCRIPTION: contains a memory mapped binary sample file and a background
+//              thread that shuffles it into training batches ahead of the
+//              network
+// AUTHOR:      Dan Fabian
+// DATE:        10/20/2019
+
+#include "network_utility.h"
+#include "mapped_file.h"
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// DATASET FILE
+// notes: binary layout, every value in native byte order
+//        char[8]   magic "NNDATA"
+//        uint32    version
+//        uint32    unused, keeps the counts aligned
+//        uint64    number of samples
+//        uint64    inputs per sample
+//        then every sample as its inputs followed by its label, all double
+const char     DATASET_MAGIC[8] = { 'N', 'N', 'D', 'A', 'T', 'A', '\0', '\0' };
+const uint32_t DATASET_VERSION = 1;
+const size_t   DATASET_HEADER_BYTES = sizeof(DATASET_MAGIC) + 2 * sizeof(uint32_t) + 2 * sizeof(uint64_t);
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// DATASET WRITER
+// notes: samples are appended one at a time so a file never has to fit in
+//        memory, the sample count in the header is filled in on close
+class DatasetWriter {
+public:
+	// constructor and destructor
+	DatasetWriter(const string& file, size_t inputs);
+	~DatasetWriter() { close(); }
+
+	DatasetWriter(const DatasetWriter&) = delete;
+	DatasetWriter& operator=(const DatasetWriter&) = delete;
+
+	// methods
+	void add   (const double* inputs, double label); // appends one sample
+	void close ();                                   // writes the sample count and closes the file
+
+private:
+	std::ofstream out_;
+	size_t        inputs_;
+	uint64_t      count_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// DATASET
+// notes: the file is mapped read only, samples are read in place and the os
+//        pages them in and out as needed so the file can be larger than memory
+class Dataset {
+public:
+	// constructor
+	explicit Dataset(const string& file);
+
+	// methods
+	size_t        size   () const { return size_; }
+	size_t        inputs () const { return inputs_; }
+	const double* sample (size_t i) const { return samples_ + i * (inputs_ + 1); } // inputs of sample i
+	double        label  (size_t i) const { return sample(i)[inputs_]; }
+
+private:
+	std::shared_ptr<MappedFile> mapping_;
+	const double*               samples_;
+	size_t                      size_;
+	size_t                      inputs_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// BATCH
+// notes: one training batch, inputs and one hot expected outputs are stored
+//        one row per sample the way BasicNetwork::train lays them out
+template <typename T>
+struct Batch {
+	valarray<T> X;
+	valarray<T> Y;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// BATCH STREAM
+// notes: a prefetch thread walks the dataset in a new random order every pass
+//        and fills up to depth batches ahead of the trainer, so reading the
+//        mapped file and page faults happen while the network is computing
+//        the batch returned by next() stays valid until next() is called again
+template <typename T>
+class BatchStream {
+public:
+	// constructor and destructor
+	BatchStream(const Dataset& data, size_t batchSize, size_t outputs, size_t depth = 2, unsigned seed = 1);
+	~BatchStream();
+
+	BatchStream(const BatchStream&) = delete;
+	BatchStream& operator=(const BatchStream&) = delete;
+
+	// methods
+	const Batch<T>& next (); // waits for the next batch and hands the previous one back to the prefetcher
+
+private:
+	// helper functions
+	void prefetch ();                // prefetch thread body
+	void fill     (Batch<T>& batch); // copies the next batchSize samples of the shuffled order into batch
+
+	const Dataset&          data_;
+	vector<Batch<T>>        slots_;     // depth + 1 batches, one of them may be held by the trainer
+	vector<size_t>          order_;     // shuffled sample indices of the current pass
+	size_t                  position_;  // next index of order_ to hand out
+	std::mt19937_64         generator_;
+	size_t                  batchSize_;
+	size_t                  outputs_;
+	uint64_t                produced_;  // batches filled so far
+	uint64_t                consumed_;  // batches handed to the trainer so far
+	uint64_t                released_;  // batches handed back by the trainer so far
+	bool                    stop_;
+	std::mutex              mutex_;
+	std::condition_variable ready_;     // a batch was filled
+	std::condition_variable free_;      // a slot was handed back
+	std::thread             thread_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// DATASET WRITER functions
+////////////////////////////////////////
+// constructor, writes a header with no samples yet
+DatasetWriter::DatasetWriter(const string& file, size_t inputs) :
+	out_(file, std::ios::binary),
+	inputs_(inputs),
+	count_(0)
+{
+	if (!out_)
+		throw std::runtime_error("can't write " + file);
+
+	uint32_t version[2] = { DATASET_VERSION, 0 };
+	uint64_t sizes[2] = { 0, inputs };
+	out_.write(DATASET_MAGIC, sizeof(DATASET_MAGIC));
+	out_.write(reinterpret_cast<const char*>(version), sizeof(version));
+	out_.write(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+}
+
+////////////////////////////////////////
+// appends one sample
+void DatasetWriter::add(const double* inputs, double label)
+{
+	out_.write(reinterpret_cast<const char*>(inputs), inputs_ * sizeof(double));
+	out_.write(reinterpret_cast<const char*>(&label), sizeof(label));
+	++count_;
+}
+
+////////////////////////////////////////
+// writes the sample count into the header and closes the file
+void DatasetWriter::close()
+{
+	if (!out_.is_open())
+		return;
+
+	out_.seekp(sizeof(DATASET_MAGIC) + 2 * sizeof(uint32_t));
+	out_.write(reinterpret_cast<const char*>(&count_), sizeof(count_));
+	out_.close();
+}
+
+////////////////////////////////////////
+// writes the first count samples of Xdata and Ydata to a dataset file
+void writeDataset(const string& file, const valarray<ValD>& Xdata, const ValD& Ydata, size_t count)
+{
+	DatasetWriter writer(file, count ? Xdata[0].size() : 0);
+	for (size_t i = 0; i != count; ++i)
+		writer.add(&Xdata[i][0], Ydata[i]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// DATASET functions
+////////////////////////////////////////
+// constructor, maps file or throws if it isn't a complete dataset file
+Dataset::Dataset(const string& file) :
+	mapping_(std::make_shared<MappedFile>(file)),
+	samples_(nullptr),
+	size_(0),
+	inputs_(0)
+{
+	const char* data = mapping_->data();
+	if (mapping_->size() < DATASET_HEADER_BYTES || memcmp(data, DATASET_MAGIC, sizeof(DATASET_MAGIC)) != 0)
+		throw std::runtime_error(file + " is not a dataset file");
+
+	uint32_t version;
+	uint64_t sizes[2];
+	memcpy(&version, data + sizeof(DATASET_MAGIC), sizeof(version));
+	memcpy(sizes, data + sizeof(DATASET_MAGIC) + 2 * sizeof(uint32_t), sizeof(sizes));
+	if (version != DATASET_VERSION)
+		throw std::runtime_error(file + " has an unsupported dataset version");
+
+	size_ = size_t(sizes[0]);
+	inputs_ = size_t(sizes[1]);
+	if ((mapping_->size() - DATASET_HEADER_BYTES) / sizeof(double) / (inputs_ + 1) < size_)
+		throw std::runtime_error(file + " is truncated");
+
+	samples_ = reinterpret_cast<const double*>(data + DATASET_HEADER_BYTES);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// BATCH STREAM functions
+////////////////////////////////////////
+// constructor, sizes every slot and starts the prefetch thread
+template <typename T>
+BatchStream<T>::BatchStream(const Dataset& data, size_t batchSize, size_t outputs, size_t depth, unsigned seed) :
+	data_(data),
+	slots_(depth + 1),
+	order_(data.size()),
+	position_(data.size()),
+	generator_(seed),
+	batchSize_(batchSize),
+	outputs_(outputs),
+	produced_(0),
+	consumed_(0),
+	released_(0),
+	stop_(false)
+{
+	if (data.size() == 0)
+		throw std::runtime_error("can't train on an empty dataset");
+
+	for (size_t s = 0; s != slots_.size(); ++s)
+	{
+		slots_[s].X.resize(batchSize * data.inputs());
+		slots_[s].Y.resize(batchSize * outputs);
+	}
+	std::iota(order_.begin(), order_.end(), size_t(0));
+
+	thread_ = std::thread(&BatchStream::prefetch, this);
+}
+
+////////////////////////////////////////
+// destructor, stops and joins the prefetch thread
+template <typename T>
+BatchStream<T>::~BatchStream()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	free_.notify_all();
+	thread_.join();
+}
+
+////////////////////////////////////////
+// waits for the next batch, the batch returned last time is handed back
+template <typename T>
+const Batch<T>& BatchStream<T>::next()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	released_ = consumed_;
+	free_.notify_one();
+
+	ready_.wait(lock, [this] { return produced_ > consumed_; });
+	return slots_[consumed_++ % slots_.size()];
+}
+
+////////////////////////////////////////
+// prefetch thread body, fills the next slot as soon as it has been handed back
+template <typename T>
+void BatchStream<T>::prefetch()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true)
+	{
+		// slots produced_ - released_ .. produced_ are still in use
+		free_.wait(lock, [this] { return stop_ || produced_ - released_ < slots_.size(); });
+		if (stop_)
+			return;
+
+		Batch<T>& batch = slots_[produced_ % slots_.size()];
+		lock.unlock();
+		fill(batch);
+		lock.lock();
+
+		++produced_;
+		ready_.notify_one();
+	}
+}
+
+////////////////////////////////////////
+// copies the next batchSize samples of the shuffled order into batch, the
+// order is reshuffled every time the whole dataset has been walked
+template <typename T>
+void BatchStream<T>::fill(Batch<T>& batch)
+{
+	const size_t inputs = data_.inputs();
+	batch.Y = 0;
+	for (size_t i = 0; i != batchSize_; ++i)
+	{
+		if (position_ == order_.size())
+		{
+			std::shuffle(order_.begin(), order_.end(), generator_);
+			position_ = 0;
+		}
+
+		const size_t index = order_[position_++];
+		const double* sample = data_.sample(index);
+		for (size_t k = 0; k != inputs; ++k)
+			batch.X[i * inputs + k] = T(sample[k]);
+		const size_t label = size_t(sample[inputs]);
+		if (label < outputs_) // a bad label leaves the row without an answer instead of writing past it
+			batch.Y[i * outputs_ + label] = 1; // set correct answer
+	}
+}
+
+#endif // DATASET_H
@@ -0,0 +1,347 @@
+#ifndef FIXED_NETWORK_H
+#define FIXED_NETWORK_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// FILE:        fixed_network.h
+// DESCRIPTION: contains a network whose layer sizes are template parameters,
+//              every weight lives in a std::array and every loop has a
+//              compile time trip count, for tiny models where the latency of
+//              a single call matters most
+// AUTHOR:      Dan Fabian
+// DATE:        10/20/2019
+
+#include "network.h"
+#include <array>
+#include <stdexcept>
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// FIXED LAYERS
+// notes: FixedLayers<T, In, Out, Rest...> holds the layer from In to Out
+//        neurons and, in next, the layers after it, FixedLayers<T, N> ends
+//        the chain at the output layer, so the whole network is one object
+//        with no heap memory and no pointers between layers
+//        weights are row-major like Layer, W[j][k] lives at weights[j * In + k]
+template <typename T, size_t In, size_t... Rest>
+struct FixedLayers;
+
+////////////////////////////////////////
+// end of the chain, the output layer
+template <typename T, size_t In>
+struct FixedLayers<T, In> {
+	static const size_t OUTPUTS = In;
+
+	void copyFrom (const vector<Layer<T>>&, size_t) {}
+	void forward  (const T* in, T* out) const { std::copy(in, in + In, out); }
+	void apply    (T, T) {}
+
+	// delta of the output layer from its activations and the expected outputs
+	void delta(const T* alpha, const T* target, T* delta)
+	{
+		for (size_t j = 0; j != In; ++j)
+			delta[j] = target[j] * (1 - alpha[j]) - alpha[j] * (1 - target[j]);
+	}
+};
+
+template <typename T, size_t In, size_t Out, size_t... Rest>
+struct FixedLayers<T, In, Out, Rest...> {
+	static const size_t OUTPUTS = FixedLayers<T, Out, Rest...>::OUTPUTS;
+
+	// constructor, drawn exactly like Layer so both networks start the same
+	FixedLayers();
+
+	// methods
+	void copyFrom   (const vector<Layer<T>>& layers, size_t l);               // copies layer l and the ones after it
+	void forward    (const T* in, T* out) const;                             // output layer activations of in
+	void accumulate (const T* in, const T* target, T* back);                 // adds the gradients of one sample, back gets W^T * delta
+	void delta      (const T* alphaPrev, const T* target, T* deltaPrev);     // delta of the previous layer from its activations
+	void apply      (T ratio, T decay);                                      // W = ratio * dW + decay * W, then clears the gradients
+
+	std::array<T, In * Out>        weights;
+	std::array<T, Out>             biases;
+	std::array<T, In * Out>        weightGrads; // summed over the samples of a batch
+	std::array<T, Out>             biasGrads;
+	FixedLayers<T, Out, Rest...>   next;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// FIXED NETWORK
+// notes: same training rule, initial weights and inputs and outputs as
+//        BasicNetwork with plain sgd, a trained BasicNetwork of the same
+//        topology can also be copied in for inference
+//        dropout, softmax outputs and the pluggable optimizers aren't supported
+template <typename T, size_t... Sizes>
+class BasicFixedNetwork {
+public:
+	static_assert(sizeof...(Sizes) >= 2, "a network needs at least an input and an output layer");
+
+	typedef FixedLayers<T, Sizes...> Layers;
+	static const size_t INPUTS = std::array<size_t, sizeof...(Sizes)>{ { Sizes... } }[0];
+	static const size_t OUTPUTS = Layers::OUTPUTS;
+
+	// constructors
+	BasicFixedNetwork(double stepConst, double lambda) : stepConstant_(stepConst), lambda_(lambda) {}
+	explicit BasicFixedNetwork(const BasicNetwork<T>& net);
+
+	// methods
+	void   train     (const valarray<ValD>& Xdata, const ValD& Ydata, const size_t& epochs,
+	                  const size_t& batchSize = 1);                                          // trains the whole network, one batch per epoch
+	double test      (const valarray<ValD>& Xdata, const ValD& Ydata,
+	                  const size_t& epochs) const;                                           // tests the network and returns a decimal of correct answers / total
+	vector<size_t> predict       (const valarray<ValD>& Xdata) const;                       // returns the argmax output neuron of every sample
+	valarray<ValD> probabilities (const valarray<ValD>& Xdata) const;                       // returns the output layer activations of every sample
+	void   setLambda (double lambda) { lambda_ = lambda; }
+	void   setStep   (double step)   { stepConstant_ = step; }
+
+	// single sample inference, nothing is allocated
+	std::array<T, OUTPUTS> outputs (const std::array<T, INPUTS>& inputs) const;
+	size_t                 predict (const std::array<T, INPUTS>& inputs) const;
+
+private:
+	Layers layers_;
+	double stepConstant_;
+	double lambda_;
+};
+
+template <size_t... Sizes> using FixedNetwork = BasicFixedNetwork<double, Sizes...>;
+template <size_t... Sizes> using FixedNetworkF = BasicFixedNetwork<float, Sizes...>;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// FIXED LAYERS functions
+////////////////////////////////////////
+// constructor, copies a freshly drawn Layer so the weights match BasicNetwork's
+template <typename T, size_t In, size_t Out, size_t... Rest>
+FixedLayers<T, In, Out, Rest...>::FixedLayers()
+{
+	Layer<T> layer(In, Out);
+	std::copy(layer.weights(), layer.weights() + In * Out, weights.begin());
+	std::copy(layer.biases(), layer.biases() + Out, biases.begin());
+	weightGrads.fill(T(0));
+	biasGrads.fill(T(0));
+}
+
+////////////////////////////////////////
+// copies layer l of a dynamic network and the ones after it
+template <typename T, size_t In, size_t Out, size_t... Rest>
+void FixedLayers<T, In, Out, Rest...>::copyFrom(const vector<Layer<T>>& layers, size_t l)
+{
+	std::copy(layers[l].weights(), layers[l].weights() + In * Out, weights.begin());
+	std::copy(layers[l].biases(), layers[l].biases() + Out, biases.begin());
+	next.copyFrom(layers, l + 1);
+}
+
+////////////////////////////////////////
+// runs in through this layer and the rest, the activations stay on the stack
+template <typename T, size_t In, size_t Out, size_t... Rest>
+void FixedLayers<T, In, Out, Rest...>::forward(const T* in, T* out) const
+{
+	std::array<T, Out> alpha;
+	for (size_t j = 0; j != Out; ++j)
+	{
+		T z = biases[j];
+		for (size_t k = 0; k != In; ++k)
+			z += weights[j * In + k] * in[k];
+		alpha[j] = T(1) / (T(1) + std::exp(-z));
+	}
+
+	next.forward(alpha.data(), out);
+}
+
+////////////////////////////////////////
+// forward and back propagation of one sample through this layer and the
+// rest, adds the gradients and, if back isn't null, writes the sum of delta
+// times the weights for every input neuron so the previous layer can find its delta
+template <typename T, size_t In, size_t Out, size_t... Rest>
+void FixedLayers<T, In, Out, Rest...>::accumulate(const T* in, const T* target, T* back)
+{
+	std::array<T, Out> alpha, d;
+	for (size_t j = 0; j != Out; ++j)
+	{
+		T z = biases[j];
+		for (size_t k = 0; k != In; ++k)
+			z += weights[j * In + k] * in[k];
+		alpha[j] = T(1) / (T(1) + std::exp(-z));
+	}
+
+	next.delta(alpha.data(), target, d.data());
+
+	for (size_t j = 0; j != Out; ++j)
+	{
+		biasGrads[j] += d[j];
+		for (size_t k = 0; k != In; ++k)
+			weightGrads[j * In + k] += d[j] * in[k];
+	}
+
+	if (back)
+		for (size_t k = 0; k != In; ++k)
+		{
+			T sum = 0;
+			for (size_t j = 0; j != Out; ++j)
+				sum += d[j] * weights[j * In + k];
+			back[k] = sum;
+		}
+}
+
+////////////////////////////////////////
+// delta of the previous layer, sigmoid'(z) = a * (1 - a) from its activations
+template <typename T, size_t In, size_t Out, size_t... Rest>
+void FixedLayers<T, In, Out, Rest...>::delta(const T* alphaPrev, const T* target, T* deltaPrev)
+{
+	std::array<T, In> back;
+	accumulate(alphaPrev, target, back.data());
+	for (size_t k = 0; k != In; ++k)
+		deltaPrev[k] = back[k] * alphaPrev[k] * (1 - alphaPrev[k]);
+}
+
+////////////////////////////////////////
+// W = ratio * dW + decay * W and b += ratio * db, then clears the gradients
+template <typename T, size_t In, size_t Out, size_t... Rest>
+void FixedLayers<T, In, Out, Rest...>::apply(T ratio, T decay)
+{
+	for (size_t i = 0; i != In * Out; ++i)
+	{
+		weights[i] = ratio * weightGrads[i] + decay * weights[i];
+		weightGrads[i] = 0;
+	}
+	for (size_t j = 0; j != Out; ++j)
+	{
+		biases[j] += ratio * biasGrads[j];
+		biasGrads[j] = 0;
+	}
+
+	next.apply(ratio, decay);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// FIXED NETWORK functions
+////////////////////////////////////////
+// copies the weights and biases of a trained network of the same topology
+template <typename T, size_t... Sizes>
+BasicFixedNetwork<T, Sizes...>::BasicFixedNetwork(const BasicNetwork<T>& net) :
+	stepConstant_(0.0),
+	lambda_(0.0)
+{
+	const size_t sizes[] = { Sizes... };
+	const vector<Layer<T>>& layers = net.layers();
+	if (net.output() != SIGMOID_OUTPUT)
+		throw std::invalid_argument("only sigmoid output layers are supported");
+	if (layers.size() != sizeof...(Sizes))
+		throw std::invalid_argument("network has a different number of layers");
+	for (size_t l = 0; l != layers.size(); ++l)
+		if (layers[l].size_ != sizes[l])
+			throw std::invalid_argument("network has different layer sizes");
+
+	layers_.copyFrom(layers, 1);
+}
+
+////////////////////////////////////////
+// trains the whole network, each epoch trains on batchSize random samples
+// picked the same way BasicNetwork::train picks them
+template <typename T, size_t... Sizes>
+void BasicFixedNetwork<T, Sizes...>::train(const valarray<ValD>& Xdata, const ValD& Ydata, const size_t& epochs, const size_t& batchSize)
+{
+	// set up random generator
+	std::default_random_engine generator;
+	std::uniform_int_distribution<int> distribution(0, Xdata.size() - 1);
+	auto rand = std::bind(distribution, generator);
+
+	const size_t rows = std::max(batchSize, size_t(1));
+	const T ratio = T(stepConstant_ / rows);
+	const T decay = 1 + T(lambda_ / Xdata.size());
+	std::array<T, INPUTS> inputs;
+	std::array<T, OUTPUTS> target;
+	for (size_t ep = 0; ep < epochs; ++ep)
+	{
+		for (size_t i = 0; i != rows; ++i)
+		{
+			size_t index = rand(); // select a random piece of data to train with
+			for (size_t k = 0; k != INPUTS; ++k)
+				inputs[k] = T(Xdata[index][k]);
+			target.fill(T(0));
+			target[size_t(Ydata[index])] = 1; // set correct answer
+
+			layers_.accumulate(inputs.data(), target.data(), nullptr);
+		}
+
+		layers_.apply(ratio, decay); // adjust weights
+	}
+}
+
+////////////////////////////////////////
+// output layer activations of a single sample
+template <typename T, size_t... Sizes>
+std::array<T, BasicFixedNetwork<T, Sizes...>::OUTPUTS> BasicFixedNetwork<T, Sizes...>::outputs(const std::array<T, INPUTS>& inputs) const
+{
+	std::array<T, OUTPUTS> out;
+	layers_.forward(inputs.data(), out.data());
+
+	return out;
+}
+
+////////////////////////////////////////
+// argmax output neuron of a single sample
+template <typename T, size_t... Sizes>
+size_t BasicFixedNetwork<T, Sizes...>::predict(const std::array<T, INPUTS>& inputs) const
+{
+	std::array<T, OUTPUTS> out = outputs(inputs);
+	return argmax(out.data(), OUTPUTS);
+}
+
+////////////////////////////////////////
+// returns the argmax output neuron of every sample
+template <typename T, size_t... Sizes>
+vector<size_t> BasicFixedNetwork<T, Sizes...>::predict(const valarray<ValD>& Xdata) const
+{
+	vector<size_t> labels(Xdata.size());
+	std::array<T, INPUTS> inputs;
+	for (size_t i = 0; i != labels.size(); ++i)
+	{
+		for (size_t k = 0; k != INPUTS; ++k)
+			inputs[k] = T(Xdata[i][k]);
+		labels[i] = predict(inputs);
+	}
+
+	return labels;
+}
+
+////////////////////////////////////////
+// returns the output layer activations of every sample
+template <typename T, size_t... Sizes>
+valarray<ValD> BasicFixedNetwork<T, Sizes...>::probabilities(const valarray<ValD>& Xdata) const
+{
+	valarray<ValD> probs(ValD(OUTPUTS), Xdata.size());
+	std::array<T, INPUTS> inputs;
+	for (size_t i = 0; i != probs.size(); ++i)
+	{
+		for (size_t k = 0; k != INPUTS; ++k)
+			inputs[k] = T(Xdata[i][k]);
+		std::array<T, OUTPUTS> out = outputs(inputs);
+		std::copy(out.begin(), out.end(), &probs[i][0]);
+	}
+
+	return probs;
+}
+
+////////////////////////////////////////
+// tests the network and returns a decimal of correct answers / total
+template <typename T, size_t... Sizes>
+double BasicFixedNetwork<T, Sizes...>::test(const valarray<ValD>& Xdata, const ValD& Ydata, const size_t& epochs) const
+{
+	std::array<T, INPUTS> inputs;
+	size_t success = 0;
+	for (size_t i = 0; i != epochs; ++i)
+	{
+		for (size_t k = 0; k != INPUTS; ++k)
+			inputs[k] = T(Xdata[i][k]);
+		if (predict(inputs) == Ydata[i])
+			++success;
+	}
+
+	return double(success) / double(epochs);
+}
+
+#endif // FIXED_NETWORK_H
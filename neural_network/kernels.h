@@ -0,0 +1,1084 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// FILE:        kernels.h
+// DESCRIPTION: contains the innermost math loops of the network with scalar,
+//              AVX2 and AVX-512 versions for double, float and int8, the best
+//              one is picked at runtime
+// AUTHOR:      Dan Fabian
+// DATE:        10/20/2019
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define KERNELS_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// gcc and clang only emit AVX instructions inside functions marked for them,
+// msvc emits whatever intrinsics it is given
+#if defined(__GNUC__)
+#define KERNEL_TARGET(isa) __attribute__((target(isa)))
+#else
+#define KERNEL_TARGET(isa)
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// KERNELS
+// notes: dot      returns sum of a[i] * b[i]
+//        axpby    computes y[i] = a * x[i] + b * y[i]
+//        sigmoid  computes out[i] = 1 / (1 + exp(-z[i])), out may alias z
+//        softmax  computes out[i] = exp(z[i] - max) / sum of exp(z[k] - max),
+//                 the max and the sum are found together in one pass by
+//                 rescaling the sum whenever the max grows, out may alias z
+//        momentum computes v[i] = mu * v[i] + rate * g[i]
+//                      then p[i] = decay * p[i] + v[i]
+//        adam     computes m[i] = beta1 * m[i] + mScale * g[i]
+//                          v[i] = beta2 * v[i] + vScale * g[i]^2
+//                      then p[i] = decay * p[i] + rate * m[i] / (sqrt(v[i]) + epsilon)
+//        the optimizer kernels read and write every element once
+
+// constants of one adam update, see Adam in optimizer.h for how they are found
+template <typename T>
+struct AdamStep {
+	T beta1, mScale;
+	T beta2, vScale;
+	T rate, epsilon, decay;
+};
+
+template <typename T>
+struct Kernels {
+	T    (*dot)      (const T* a, const T* b, size_t n);
+	void (*axpby)    (T a, const T* x, T b, T* y, size_t n);
+	void (*sigmoid)  (const T* z, T* out, size_t n);
+	void (*softmax)  (const T* z, T* out, size_t n);
+	void (*momentum) (T rate, const T* g, T mu, T* v, T decay, T* p, size_t n);
+	void (*adam)     (const AdamStep<T>& step, const T* g, T* m, T* v, T* p, size_t n);
+	const char* name;
+};
+
+// int8 matrix product with exact int32 sums, used by quantized inference
+// gemm computes c[i * cols + j] = sum over k of a[i * depth + k] * b[j * depth + k]
+//      a holds int8 values widened to int16 and b holds int8, so every row
+//      of b is loaded and widened once for INT8_ROWS rows of a
+//      rows has to be a multiple of INT8_ROWS and depth of INT8_DEPTH, the
+//      callers pad with zeros so no kernel has a tail
+// quantize   finds scale = max |x[i]| / 127 (1 if x is all zero) and writes
+//            q[i] = x[i] / scale rounded half away from zero for i < n and
+//            q[i] = 0 for n <= i < depth, returns scale
+// dequantize computes out[i] = sums[i] * scale + biases[i], fused into one
+//            rounding by the vector versions
+// every quantize rounds the same way so they all give identical results
+const size_t INT8_ROWS = 4;
+const size_t INT8_DEPTH = 32;
+
+struct Int8Kernels {
+	void  (*gemm)       (const int16_t* a, const int8_t* b, size_t rows, size_t cols, size_t depth, int32_t* c);
+	float (*quantize)   (const float* x, int16_t* q, size_t n, size_t depth);
+	void  (*dequantize) (const int32_t* sums, float scale, const float* biases, float* out, size_t n);
+	const char* name;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// SCALAR kernels
+////////////////////////////////////////
+// dot product
+template <typename T>
+T dotScalar(const T* a, const T* b, size_t n)
+{
+	T sum = 0;
+	for (size_t i = 0; i != n; ++i)
+		sum += a[i] * b[i];
+
+	return sum;
+}
+
+////////////////////////////////////////
+// y = a * x + b * y
+template <typename T>
+void axpbyScalar(T a, const T* x, T b, T* y, size_t n)
+{
+	for (size_t i = 0; i != n; ++i)
+		y[i] = a * x[i] + b * y[i];
+}
+
+////////////////////////////////////////
+// sigmoid
+template <typename T>
+void sigmoidScalar(const T* z, T* out, size_t n)
+{
+	for (size_t i = 0; i != n; ++i)
+		out[i] = T(1) / (T(1) + std::exp(-z[i]));
+}
+
+////////////////////////////////////////
+// adds z[first .. n) to a running max and sum of exp(z - max)
+template <typename T>
+void softmaxAccumulate(const T* z, size_t first, size_t n, T& max, T& sum)
+{
+	for (size_t i = first; i != n; ++i)
+		if (z[i] > max)
+		{
+			sum = sum * std::exp(max - z[i]) + 1;
+			max = z[i];
+		}
+		else
+			sum += std::exp(z[i] - max);
+}
+
+////////////////////////////////////////
+// softmax
+template <typename T>
+void softmaxScalar(const T* z, T* out, size_t n)
+{
+	T max = std::numeric_limits<T>::lowest(), sum = 0;
+	softmaxAccumulate(z, 0, n, max, sum);
+
+	const T scale = 1 / sum;
+	for (size_t i = 0; i != n; ++i)
+		out[i] = std::exp(z[i] - max) * scale;
+}
+
+////////////////////////////////////////
+// momentum update
+template <typename T>
+void momentumScalar(T rate, const T* g, T mu, T* v, T decay, T* p, size_t n)
+{
+	for (size_t i = 0; i != n; ++i)
+	{
+		v[i] = mu * v[i] + rate * g[i];
+		p[i] = decay * p[i] + v[i];
+	}
+}
+
+////////////////////////////////////////
+// adam update
+template <typename T>
+void adamScalar(const AdamStep<T>& step, const T* g, T* m, T* v, T* p, size_t n)
+{
+	for (size_t i = 0; i != n; ++i)
+	{
+		m[i] = step.beta1 * m[i] + step.mScale * g[i];
+		v[i] = step.beta2 * v[i] + step.vScale * g[i] * g[i];
+		p[i] = step.decay * p[i] + step.rate * m[i] / (std::sqrt(v[i]) + step.epsilon);
+	}
+}
+
+////////////////////////////////////////
+// int8 matrix product
+void gemmInt8Scalar(const int16_t* a, const int8_t* b, size_t rows, size_t cols, size_t depth, int32_t* c)
+{
+	for (size_t i = 0; i != rows; ++i)
+		for (size_t j = 0; j != cols; ++j)
+		{
+			int32_t sum = 0;
+			for (size_t k = 0; k != depth; ++k)
+				sum += int32_t(a[i * depth + k]) * int32_t(b[j * depth + k]);
+			c[i * cols + j] = sum;
+		}
+}
+
+////////////////////////////////////////
+// int8 quantization of one row
+float quantizeInt8Scalar(const float* x, int16_t* q, size_t n, size_t depth)
+{
+	float maxAbs = 0.0f;
+	for (size_t i = 0; i != n; ++i)
+		maxAbs = std::max(maxAbs, std::fabs(x[i]));
+	const float scale = maxAbs > 0.0f ? maxAbs / 127.0f : 1.0f;
+
+	const float inverse = 1.0f / scale;
+	for (size_t i = 0; i != n; ++i)
+	{
+		const float v = x[i] * inverse;
+		q[i] = int16_t(v + (v < 0.0f ? -0.5f : 0.5f));
+	}
+	std::fill(q + n, q + depth, int16_t(0));
+
+	return scale;
+}
+
+////////////////////////////////////////
+// int8 dequantization of one row
+void dequantizeInt8Scalar(const int32_t* sums, float scale, const float* biases, float* out, size_t n)
+{
+	for (size_t i = 0; i != n; ++i)
+		out[i] = float(sums[i]) * scale + biases[i];
+}
+
+#ifdef KERNELS_X86
+////////////////////////////////////////////////////////////////////////////////
+//
+// AVX2 kernels
+// notes: exp(x) is computed as 2^n * p(r) with n = round(x / ln 2) and
+//        r = x - n ln 2, p is the taylor series of exp to degree 11 which is
+//        accurate to about 1e-15 relative for |r| <= ln 2 / 2
+const double EXP_LIMIT = 708.0; // exp overflows past ~709.78, sigmoid is 0 or 1 long before
+const double LN2_HI = 6.93145751953125e-1;
+const double LN2_LO = 1.42860682030941723212e-6;
+const double LOG2E = 1.4426950408889634;
+
+////////////////////////////////////////
+// dot product
+KERNEL_TARGET("avx2,fma")
+double dotAvx2(const double* a, const double* b, size_t n)
+{
+	__m256d sum0 = _mm256_setzero_pd(), sum1 = _mm256_setzero_pd();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		sum0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), sum0);
+		sum1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4), sum1);
+	}
+	for (; i + 4 <= n; i += 4)
+		sum0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), sum0);
+
+	// horizontal sum of the 4 lanes
+	sum0 = _mm256_add_pd(sum0, sum1);
+	__m128d half = _mm_add_pd(_mm256_castpd256_pd128(sum0), _mm256_extractf128_pd(sum0, 1));
+	double sum = _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+
+	for (; i != n; ++i)
+		sum += a[i] * b[i];
+
+	return sum;
+}
+
+////////////////////////////////////////
+// y = a * x + b * y
+KERNEL_TARGET("avx2,fma")
+void axpbyAvx2(double a, const double* x, double b, double* y, size_t n)
+{
+	const __m256d va = _mm256_set1_pd(a), vb = _mm256_set1_pd(b);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+		_mm256_storeu_pd(y + i, _mm256_fmadd_pd(va, _mm256_loadu_pd(x + i), _mm256_mul_pd(vb, _mm256_loadu_pd(y + i))));
+	for (; i != n; ++i)
+		y[i] = a * x[i] + b * y[i];
+}
+
+////////////////////////////////////////
+// exp of 4 doubles
+KERNEL_TARGET("avx2,fma")
+__m256d expAvx2(__m256d x)
+{
+	x = _mm256_max_pd(_mm256_min_pd(x, _mm256_set1_pd(EXP_LIMIT)), _mm256_set1_pd(-EXP_LIMIT));
+
+	// n = round(x / ln 2), r = x - n ln 2 in two steps to keep r exact
+	__m256d n = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256d r = _mm256_fnmadd_pd(n, _mm256_set1_pd(LN2_HI), x);
+	r = _mm256_fnmadd_pd(n, _mm256_set1_pd(LN2_LO), r);
+
+	// taylor series by horner's rule
+	__m256d p = _mm256_set1_pd(1.0 / 39916800.0);
+	p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 3628800.0));
+	p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 362880.0));
+	p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 40320.0));
+	p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 5040.0));
+	p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 720.0));
+	p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 120.0));
+	p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 24.0));
+	p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0 / 6.0));
+	p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(0.5));
+	p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0));
+	p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(1.0));
+
+	// 2^n built directly in the exponent bits, adding 1.5 * 2^52 leaves n in the low mantissa bits
+	const __m256d magic = _mm256_set1_pd(6755399441055744.0);
+	__m256i k = _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(n, magic)), _mm256_castpd_si256(magic));
+	__m256d scale = _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_add_epi64(k, _mm256_set1_epi64x(1023)), 52));
+
+	return _mm256_mul_pd(p, scale);
+}
+
+////////////////////////////////////////
+// sigmoid
+KERNEL_TARGET("avx2,fma")
+void sigmoidAvx2(const double* z, double* out, size_t n)
+{
+	const __m256d one = _mm256_set1_pd(1.0), zero = _mm256_setzero_pd();
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m256d e = expAvx2(_mm256_sub_pd(zero, _mm256_loadu_pd(z + i)));
+		_mm256_storeu_pd(out + i, _mm256_div_pd(one, _mm256_add_pd(one, e)));
+	}
+	for (; i != n; ++i)
+		out[i] = 1.0 / (1.0 + std::exp(-z[i]));
+}
+
+////////////////////////////////////////
+// softmax, every lane keeps its own running max and sum which are merged
+// before the tail, then a second pass writes the normalized outputs
+KERNEL_TARGET("avx2,fma")
+void softmaxAvx2(const double* z, double* out, size_t n)
+{
+	__m256d vmax = _mm256_set1_pd(std::numeric_limits<double>::lowest()), vsum = _mm256_setzero_pd();
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m256d x = _mm256_loadu_pd(z + i);
+		__m256d newMax = _mm256_max_pd(vmax, x);
+		vsum = _mm256_fmadd_pd(vsum, expAvx2(_mm256_sub_pd(vmax, newMax)), expAvx2(_mm256_sub_pd(x, newMax)));
+		vmax = newMax;
+	}
+
+	// merge the lanes, then the tail
+	double lanesMax[4], lanesSum[4];
+	_mm256_storeu_pd(lanesMax, vmax);
+	_mm256_storeu_pd(lanesSum, vsum);
+	double max = std::max(std::max(lanesMax[0], lanesMax[1]), std::max(lanesMax[2], lanesMax[3])), sum = 0;
+	for (size_t l = 0; l != 4; ++l)
+		sum += lanesSum[l] * std::exp(lanesMax[l] - max);
+	softmaxAccumulate(z, i, n, max, sum);
+
+	const __m256d vscale = _mm256_set1_pd(1 / sum), vmaxAll = _mm256_set1_pd(max);
+	for (i = 0; i + 4 <= n; i += 4)
+		_mm256_storeu_pd(out + i, _mm256_mul_pd(expAvx2(_mm256_sub_pd(_mm256_loadu_pd(z + i), vmaxAll)), vscale));
+	for (; i != n; ++i)
+		out[i] = std::exp(z[i] - max) / sum;
+}
+
+////////////////////////////////////////
+// momentum update
+KERNEL_TARGET("avx2,fma")
+void momentumAvx2(double rate, const double* g, double mu, double* v, double decay, double* p, size_t n)
+{
+	const __m256d vrate = _mm256_set1_pd(rate), vmu = _mm256_set1_pd(mu), vdecay = _mm256_set1_pd(decay);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m256d vv = _mm256_fmadd_pd(vmu, _mm256_loadu_pd(v + i), _mm256_mul_pd(vrate, _mm256_loadu_pd(g + i)));
+		_mm256_storeu_pd(v + i, vv);
+		_mm256_storeu_pd(p + i, _mm256_fmadd_pd(vdecay, _mm256_loadu_pd(p + i), vv));
+	}
+	momentumScalar(rate, g + i, mu, v + i, decay, p + i, n - i);
+}
+
+////////////////////////////////////////
+// adam update
+KERNEL_TARGET("avx2,fma")
+void adamAvx2(const AdamStep<double>& step, const double* g, double* m, double* v, double* p, size_t n)
+{
+	const __m256d beta1 = _mm256_set1_pd(step.beta1), mScale = _mm256_set1_pd(step.mScale);
+	const __m256d beta2 = _mm256_set1_pd(step.beta2), vScale = _mm256_set1_pd(step.vScale);
+	const __m256d rate = _mm256_set1_pd(step.rate), epsilon = _mm256_set1_pd(step.epsilon), decay = _mm256_set1_pd(step.decay);
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m256d vg = _mm256_loadu_pd(g + i);
+		__m256d vm = _mm256_fmadd_pd(beta1, _mm256_loadu_pd(m + i), _mm256_mul_pd(mScale, vg));
+		__m256d vv = _mm256_fmadd_pd(beta2, _mm256_loadu_pd(v + i), _mm256_mul_pd(vScale, _mm256_mul_pd(vg, vg)));
+		__m256d update = _mm256_div_pd(_mm256_mul_pd(rate, vm), _mm256_add_pd(_mm256_sqrt_pd(vv), epsilon));
+		_mm256_storeu_pd(m + i, vm);
+		_mm256_storeu_pd(v + i, vv);
+		_mm256_storeu_pd(p + i, _mm256_fmadd_pd(decay, _mm256_loadu_pd(p + i), update));
+	}
+	adamScalar(step, g + i, m + i, v + i, p + i, n - i);
+}
+
+////////////////////////////////////////
+// dot product, float
+KERNEL_TARGET("avx2,fma")
+float dotAvx2(const float* a, const float* b, size_t n)
+{
+	__m256 sum0 = _mm256_setzero_ps(), sum1 = _mm256_setzero_ps();
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0);
+		sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), sum1);
+	}
+	for (; i + 8 <= n; i += 8)
+		sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), sum0);
+
+	// horizontal sum of the 8 lanes
+	sum0 = _mm256_add_ps(sum0, sum1);
+	__m128 half = _mm_add_ps(_mm256_castps256_ps128(sum0), _mm256_extractf128_ps(sum0, 1));
+	half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+	float sum = _mm_cvtss_f32(_mm_add_ss(half, _mm_shuffle_ps(half, half, 1)));
+
+	for (; i != n; ++i)
+		sum += a[i] * b[i];
+
+	return sum;
+}
+
+////////////////////////////////////////
+// y = a * x + b * y, float
+KERNEL_TARGET("avx2,fma")
+void axpbyAvx2(float a, const float* x, float b, float* y, size_t n)
+{
+	const __m256 va = _mm256_set1_ps(a), vb = _mm256_set1_ps(b);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_mul_ps(vb, _mm256_loadu_ps(y + i))));
+	for (; i != n; ++i)
+		y[i] = a * x[i] + b * y[i];
+}
+
+////////////////////////////////////////
+// exp of 8 floats, taylor series to degree 7 is enough for float precision
+const float EXP_LIMIT_F = 87.0f;
+const float LN2_HI_F = 6.93359375e-1f;
+const float LN2_LO_F = -2.12194440e-4f;
+const float LOG2E_F = 1.44269504f;
+
+KERNEL_TARGET("avx2,fma")
+__m256 expAvx2(__m256 x)
+{
+	x = _mm256_max_ps(_mm256_min_ps(x, _mm256_set1_ps(EXP_LIMIT_F)), _mm256_set1_ps(-EXP_LIMIT_F));
+
+	__m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(LOG2E_F)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(LN2_HI_F), x);
+	r = _mm256_fnmadd_ps(n, _mm256_set1_ps(LN2_LO_F), r);
+
+	__m256 p = _mm256_set1_ps(1.0f / 5040.0f);
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.0f / 720.0f));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.0f / 120.0f));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.0f / 24.0f));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.0f / 6.0f));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(0.5f));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.0f));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.0f));
+
+	// 2^n built directly in the exponent bits
+	__m256i k = _mm256_cvtps_epi32(n);
+	__m256 scale = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(k, _mm256_set1_epi32(127)), 23));
+
+	return _mm256_mul_ps(p, scale);
+}
+
+////////////////////////////////////////
+// sigmoid, float
+KERNEL_TARGET("avx2,fma")
+void sigmoidAvx2(const float* z, float* out, size_t n)
+{
+	const __m256 one = _mm256_set1_ps(1.0f), zero = _mm256_setzero_ps();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256 e = expAvx2(_mm256_sub_ps(zero, _mm256_loadu_ps(z + i)));
+		_mm256_storeu_ps(out + i, _mm256_div_ps(one, _mm256_add_ps(one, e)));
+	}
+	for (; i != n; ++i)
+		out[i] = 1.0f / (1.0f + std::exp(-z[i]));
+}
+
+////////////////////////////////////////
+// softmax, float
+KERNEL_TARGET("avx2,fma")
+void softmaxAvx2(const float* z, float* out, size_t n)
+{
+	__m256 vmax = _mm256_set1_ps(std::numeric_limits<float>::lowest()), vsum = _mm256_setzero_ps();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256 x = _mm256_loadu_ps(z + i);
+		__m256 newMax = _mm256_max_ps(vmax, x);
+		vsum = _mm256_fmadd_ps(vsum, expAvx2(_mm256_sub_ps(vmax, newMax)), expAvx2(_mm256_sub_ps(x, newMax)));
+		vmax = newMax;
+	}
+
+	// merge the lanes, then the tail
+	float lanesMax[8], lanesSum[8];
+	_mm256_storeu_ps(lanesMax, vmax);
+	_mm256_storeu_ps(lanesSum, vsum);
+	float max = lanesMax[0], sum = 0;
+	for (size_t l = 1; l != 8; ++l)
+		max = std::max(max, lanesMax[l]);
+	for (size_t l = 0; l != 8; ++l)
+		sum += lanesSum[l] * std::exp(lanesMax[l] - max);
+	softmaxAccumulate(z, i, n, max, sum);
+
+	const __m256 vscale = _mm256_set1_ps(1 / sum), vmaxAll = _mm256_set1_ps(max);
+	for (i = 0; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(expAvx2(_mm256_sub_ps(_mm256_loadu_ps(z + i), vmaxAll)), vscale));
+	for (; i != n; ++i)
+		out[i] = std::exp(z[i] - max) / sum;
+}
+
+////////////////////////////////////////
+// momentum update, float
+KERNEL_TARGET("avx2,fma")
+void momentumAvx2(float rate, const float* g, float mu, float* v, float decay, float* p, size_t n)
+{
+	const __m256 vrate = _mm256_set1_ps(rate), vmu = _mm256_set1_ps(mu), vdecay = _mm256_set1_ps(decay);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256 vv = _mm256_fmadd_ps(vmu, _mm256_loadu_ps(v + i), _mm256_mul_ps(vrate, _mm256_loadu_ps(g + i)));
+		_mm256_storeu_ps(v + i, vv);
+		_mm256_storeu_ps(p + i, _mm256_fmadd_ps(vdecay, _mm256_loadu_ps(p + i), vv));
+	}
+	momentumScalar(rate, g + i, mu, v + i, decay, p + i, n - i);
+}
+
+////////////////////////////////////////
+// adam update, float
+KERNEL_TARGET("avx2,fma")
+void adamAvx2(const AdamStep<float>& step, const float* g, float* m, float* v, float* p, size_t n)
+{
+	const __m256 beta1 = _mm256_set1_ps(step.beta1), mScale = _mm256_set1_ps(step.mScale);
+	const __m256 beta2 = _mm256_set1_ps(step.beta2), vScale = _mm256_set1_ps(step.vScale);
+	const __m256 rate = _mm256_set1_ps(step.rate), epsilon = _mm256_set1_ps(step.epsilon), decay = _mm256_set1_ps(step.decay);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256 vg = _mm256_loadu_ps(g + i);
+		__m256 vm = _mm256_fmadd_ps(beta1, _mm256_loadu_ps(m + i), _mm256_mul_ps(mScale, vg));
+		__m256 vv = _mm256_fmadd_ps(beta2, _mm256_loadu_ps(v + i), _mm256_mul_ps(vScale, _mm256_mul_ps(vg, vg)));
+		__m256 update = _mm256_div_ps(_mm256_mul_ps(rate, vm), _mm256_add_ps(_mm256_sqrt_ps(vv), epsilon));
+		_mm256_storeu_ps(m + i, vm);
+		_mm256_storeu_ps(v + i, vv);
+		_mm256_storeu_ps(p + i, _mm256_fmadd_ps(decay, _mm256_loadu_ps(p + i), update));
+	}
+	adamScalar(step, g + i, m + i, v + i, p + i, n - i);
+}
+
+////////////////////////////////////////
+// adds up the four int32 vectors of INT8_ROWS rows and stores each total
+KERNEL_TARGET("avx2,fma")
+inline void storeInt8Sums(__m256i s0, __m256i s1, __m256i s2, __m256i s3, int32_t* c, size_t cols)
+{
+	const __m256i pairs = _mm256_hadd_epi32(_mm256_hadd_epi32(s0, s1), _mm256_hadd_epi32(s2, s3));
+	const __m128i sums = _mm_add_epi32(_mm256_castsi256_si128(pairs), _mm256_extracti128_si256(pairs, 1));
+	c[0] = _mm_cvtsi128_si32(sums);
+	c[cols] = _mm_extract_epi32(sums, 1);
+	c[2 * cols] = _mm_extract_epi32(sums, 2);
+	c[3 * cols] = _mm_extract_epi32(sums, 3);
+}
+
+////////////////////////////////////////
+// int8 matrix product, 16 weights at a time are widened to int16 and
+// multiplied into four rows of a by madd, which sums pairs into int32
+KERNEL_TARGET("avx2,fma")
+void gemmInt8Avx2(const int16_t* a, const int8_t* b, size_t rows, size_t cols, size_t depth, int32_t* c)
+{
+	for (size_t i = 0; i < rows; i += INT8_ROWS)
+	{
+		const int16_t* a0 = a + i * depth;
+		for (size_t j = 0; j != cols; ++j)
+		{
+			const int8_t* w = b + j * depth;
+			__m256i s0 = _mm256_setzero_si256(), s1 = s0, s2 = s0, s3 = s0;
+			for (size_t k = 0; k < depth; k += 16)
+			{
+				const __m256i vw = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(w + k)));
+				s0 = _mm256_add_epi32(s0, _mm256_madd_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a0 + k)), vw));
+				s1 = _mm256_add_epi32(s1, _mm256_madd_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a0 + depth + k)), vw));
+				s2 = _mm256_add_epi32(s2, _mm256_madd_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a0 + 2 * depth + k)), vw));
+				s3 = _mm256_add_epi32(s3, _mm256_madd_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a0 + 3 * depth + k)), vw));
+			}
+			storeInt8Sums(s0, s1, s2, s3, c + i * cols + j, cols);
+		}
+	}
+}
+
+////////////////////////////////////////
+// int8 quantization of one row, x * inverse is rounded by adding 0.5 with
+// the sign of x and truncating
+KERNEL_TARGET("avx2,fma")
+float quantizeInt8Avx2(const float* x, int16_t* q, size_t n, size_t depth)
+{
+	const __m256 sign = _mm256_set1_ps(-0.0f);
+	__m256 vmax = _mm256_setzero_ps();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+		vmax = _mm256_max_ps(vmax, _mm256_andnot_ps(sign, _mm256_loadu_ps(x + i)));
+	__m128 m = _mm_max_ps(_mm256_castps256_ps128(vmax), _mm256_extractf128_ps(vmax, 1));
+	m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+	m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+	float maxAbs = _mm_cvtss_f32(m);
+	for (; i != n; ++i)
+		maxAbs = std::max(maxAbs, std::fabs(x[i]));
+	const float scale = maxAbs > 0.0f ? maxAbs / 127.0f : 1.0f;
+
+	const float inverse = 1.0f / scale;
+	const __m256 vinverse = _mm256_set1_ps(inverse), half = _mm256_set1_ps(0.5f);
+	for (i = 0; i + 8 <= n; i += 8)
+	{
+		const __m256 v = _mm256_mul_ps(_mm256_loadu_ps(x + i), vinverse);
+		const __m256i r = _mm256_cvttps_epi32(_mm256_add_ps(v, _mm256_or_ps(_mm256_and_ps(v, sign), half)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(q + i), _mm_packs_epi32(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1)));
+	}
+	for (; i != n; ++i)
+	{
+		const float v = x[i] * inverse;
+		q[i] = int16_t(v + (v < 0.0f ? -0.5f : 0.5f));
+	}
+	std::fill(q + n, q + depth, int16_t(0));
+
+	return scale;
+}
+
+////////////////////////////////////////
+// int8 dequantization of one row
+KERNEL_TARGET("avx2,fma")
+void dequantizeInt8Avx2(const int32_t* sums, float scale, const float* biases, float* out, size_t n)
+{
+	const __m256 vscale = _mm256_set1_ps(scale);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		const __m256 v = _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(sums + i)));
+		_mm256_storeu_ps(out + i, _mm256_fmadd_ps(v, vscale, _mm256_loadu_ps(biases + i)));
+	}
+	for (; i != n; ++i)
+		out[i] = std::fma(float(sums[i]), scale, biases[i]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// AVX-512 kernels
+////////////////////////////////////////
+// dot product
+KERNEL_TARGET("avx512f")
+double dotAvx512(const double* a, const double* b, size_t n)
+{
+	__m512d sum0 = _mm512_setzero_pd(), sum1 = _mm512_setzero_pd();
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		sum0 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i), sum0);
+		sum1 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i + 8), _mm512_loadu_pd(b + i + 8), sum1);
+	}
+
+	// remaining elements through a mask so there is no scalar tail
+	for (; i < n; i += 8)
+	{
+		__mmask8 mask = n - i >= 8 ? __mmask8(0xFF) : __mmask8((1u << (n - i)) - 1);
+		sum0 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(mask, a + i), _mm512_maskz_loadu_pd(mask, b + i), sum0);
+	}
+
+	return _mm512_reduce_add_pd(_mm512_add_pd(sum0, sum1));
+}
+
+////////////////////////////////////////
+// y = a * x + b * y
+KERNEL_TARGET("avx512f")
+void axpbyAvx512(double a, const double* x, double b, double* y, size_t n)
+{
+	const __m512d va = _mm512_set1_pd(a), vb = _mm512_set1_pd(b);
+	for (size_t i = 0; i < n; i += 8)
+	{
+		__mmask8 mask = n - i >= 8 ? __mmask8(0xFF) : __mmask8((1u << (n - i)) - 1);
+		__m512d vy = _mm512_maskz_loadu_pd(mask, y + i);
+		_mm512_mask_storeu_pd(y + i, mask, _mm512_fmadd_pd(va, _mm512_maskz_loadu_pd(mask, x + i), _mm512_mul_pd(vb, vy)));
+	}
+}
+
+////////////////////////////////////////
+// exp of 8 doubles, same reduction as expAvx2 but scalef applies 2^n
+KERNEL_TARGET("avx512f")
+__m512d expAvx512(__m512d x)
+{
+	x = _mm512_max_pd(_mm512_min_pd(x, _mm512_set1_pd(EXP_LIMIT)), _mm512_set1_pd(-EXP_LIMIT));
+
+	__m512d n = _mm512_roundscale_pd(_mm512_mul_pd(x, _mm512_set1_pd(LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m512d r = _mm512_fnmadd_pd(n, _mm512_set1_pd(LN2_HI), x);
+	r = _mm512_fnmadd_pd(n, _mm512_set1_pd(LN2_LO), r);
+
+	__m512d p = _mm512_set1_pd(1.0 / 39916800.0);
+	p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(1.0 / 3628800.0));
+	p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(1.0 / 362880.0));
+	p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(1.0 / 40320.0));
+	p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(1.0 / 5040.0));
+	p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(1.0 / 720.0));
+	p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(1.0 / 120.0));
+	p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(1.0 / 24.0));
+	p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(1.0 / 6.0));
+	p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(0.5));
+	p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(1.0));
+	p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(1.0));
+
+	return _mm512_scalef_pd(p, n);
+}
+
+////////////////////////////////////////
+// sigmoid
+KERNEL_TARGET("avx512f")
+void sigmoidAvx512(const double* z, double* out, size_t n)
+{
+	const __m512d one = _mm512_set1_pd(1.0), zero = _mm512_setzero_pd();
+	for (size_t i = 0; i < n; i += 8)
+	{
+		__mmask8 mask = n - i >= 8 ? __mmask8(0xFF) : __mmask8((1u << (n - i)) - 1);
+		__m512d e = expAvx512(_mm512_sub_pd(zero, _mm512_maskz_loadu_pd(mask, z + i)));
+		_mm512_mask_storeu_pd(out + i, mask, _mm512_div_pd(one, _mm512_add_pd(one, e)));
+	}
+}
+
+////////////////////////////////////////
+// softmax, lanes past the end are masked out of both the max and the sum
+KERNEL_TARGET("avx512f")
+void softmaxAvx512(const double* z, double* out, size_t n)
+{
+	const __m512d lowest = _mm512_set1_pd(std::numeric_limits<double>::lowest());
+	__m512d vmax = lowest, vsum = _mm512_setzero_pd();
+	for (size_t i = 0; i < n; i += 8)
+	{
+		__mmask8 mask = n - i >= 8 ? __mmask8(0xFF) : __mmask8((1u << (n - i)) - 1);
+		__m512d x = _mm512_mask_loadu_pd(lowest, mask, z + i);
+		__m512d newMax = _mm512_mask_max_pd(vmax, mask, vmax, x);
+		__m512d e = _mm512_maskz_mov_pd(mask, expAvx512(_mm512_sub_pd(x, newMax)));
+		vsum = _mm512_fmadd_pd(vsum, expAvx512(_mm512_sub_pd(vmax, newMax)), e);
+		vmax = newMax;
+	}
+
+	const double max = _mm512_reduce_max_pd(vmax);
+	const double sum = _mm512_reduce_add_pd(_mm512_mul_pd(vsum, expAvx512(_mm512_sub_pd(vmax, _mm512_set1_pd(max)))));
+
+	const __m512d vscale = _mm512_set1_pd(1 / sum), vmaxAll = _mm512_set1_pd(max);
+	for (size_t i = 0; i < n; i += 8)
+	{
+		__mmask8 mask = n - i >= 8 ? __mmask8(0xFF) : __mmask8((1u << (n - i)) - 1);
+		__m512d e = expAvx512(_mm512_sub_pd(_mm512_maskz_loadu_pd(mask, z + i), vmaxAll));
+		_mm512_mask_storeu_pd(out + i, mask, _mm512_mul_pd(e, vscale));
+	}
+}
+
+////////////////////////////////////////
+// momentum update
+KERNEL_TARGET("avx512f")
+void momentumAvx512(double rate, const double* g, double mu, double* v, double decay, double* p, size_t n)
+{
+	const __m512d vrate = _mm512_set1_pd(rate), vmu = _mm512_set1_pd(mu), vdecay = _mm512_set1_pd(decay);
+	for (size_t i = 0; i < n; i += 8)
+	{
+		__mmask8 mask = n - i >= 8 ? __mmask8(0xFF) : __mmask8((1u << (n - i)) - 1);
+		__m512d vv = _mm512_fmadd_pd(vmu, _mm512_maskz_loadu_pd(mask, v + i), _mm512_mul_pd(vrate, _mm512_maskz_loadu_pd(mask, g + i)));
+		_mm512_mask_storeu_pd(v + i, mask, vv);
+		_mm512_mask_storeu_pd(p + i, mask, _mm512_fmadd_pd(vdecay, _mm512_maskz_loadu_pd(mask, p + i), vv));
+	}
+}
+
+////////////////////////////////////////
+// adam update
+KERNEL_TARGET("avx512f")
+void adamAvx512(const AdamStep<double>& step, const double* g, double* m, double* v, double* p, size_t n)
+{
+	const __m512d beta1 = _mm512_set1_pd(step.beta1), mScale = _mm512_set1_pd(step.mScale);
+	const __m512d beta2 = _mm512_set1_pd(step.beta2), vScale = _mm512_set1_pd(step.vScale);
+	const __m512d rate = _mm512_set1_pd(step.rate), epsilon = _mm512_set1_pd(step.epsilon), decay = _mm512_set1_pd(step.decay);
+	for (size_t i = 0; i < n; i += 8)
+	{
+		__mmask8 mask = n - i >= 8 ? __mmask8(0xFF) : __mmask8((1u << (n - i)) - 1);
+		__m512d vg = _mm512_maskz_loadu_pd(mask, g + i);
+		__m512d vm = _mm512_fmadd_pd(beta1, _mm512_maskz_loadu_pd(mask, m + i), _mm512_mul_pd(mScale, vg));
+		__m512d vv = _mm512_fmadd_pd(beta2, _mm512_maskz_loadu_pd(mask, v + i), _mm512_mul_pd(vScale, _mm512_mul_pd(vg, vg)));
+		__m512d update = _mm512_div_pd(_mm512_mul_pd(rate, vm), _mm512_add_pd(_mm512_sqrt_pd(vv), epsilon));
+		_mm512_mask_storeu_pd(m + i, mask, vm);
+		_mm512_mask_storeu_pd(v + i, mask, vv);
+		_mm512_mask_storeu_pd(p + i, mask, _mm512_fmadd_pd(decay, _mm512_maskz_loadu_pd(mask, p + i), update));
+	}
+}
+
+////////////////////////////////////////
+// dot product, float
+KERNEL_TARGET("avx512f")
+float dotAvx512(const float* a, const float* b, size_t n)
+{
+	__m512 sum0 = _mm512_setzero_ps(), sum1 = _mm512_setzero_ps();
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32)
+	{
+		sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), sum0);
+		sum1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), sum1);
+	}
+	for (; i < n; i += 16)
+	{
+		__mmask16 mask = n - i >= 16 ? __mmask16(0xFFFF) : __mmask16((1u << (n - i)) - 1);
+		sum0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i), sum0);
+	}
+
+	return _mm512_reduce_add_ps(_mm512_add_ps(sum0, sum1));
+}
+
+////////////////////////////////////////
+// y = a * x + b * y, float
+KERNEL_TARGET("avx512f")
+void axpbyAvx512(float a, const float* x, float b, float* y, size_t n)
+{
+	const __m512 va = _mm512_set1_ps(a), vb = _mm512_set1_ps(b);
+	for (size_t i = 0; i < n; i += 16)
+	{
+		__mmask16 mask = n - i >= 16 ? __mmask16(0xFFFF) : __mmask16((1u << (n - i)) - 1);
+		__m512 vy = _mm512_maskz_loadu_ps(mask, y + i);
+		_mm512_mask_storeu_ps(y + i, mask, _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(mask, x + i), _mm512_mul_ps(vb, vy)));
+	}
+}
+
+////////////////////////////////////////
+// exp of 16 floats
+KERNEL_TARGET("avx512f")
+__m512 expAvx512(__m512 x)
+{
+	x = _mm512_max_ps(_mm512_min_ps(x, _mm512_set1_ps(EXP_LIMIT_F)), _mm512_set1_ps(-EXP_LIMIT_F));
+
+	__m512 n = _mm512_roundscale_ps(_mm512_mul_ps(x, _mm512_set1_ps(LOG2E_F)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(LN2_HI_F), x);
+	r = _mm512_fnmadd_ps(n, _mm512_set1_ps(LN2_LO_F), r);
+
+	__m512 p = _mm512_set1_ps(1.0f / 5040.0f);
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.0f / 720.0f));
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.0f / 120.0f));
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.0f / 24.0f));
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.0f / 6.0f));
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(0.5f));
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.0f));
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(1.0f));
+
+	return _mm512_scalef_ps(p, n);
+}
+
+////////////////////////////////////////
+// sigmoid, float
+KERNEL_TARGET("avx512f")
+void sigmoidAvx512(const float* z, float* out, size_t n)
+{
+	const __m512 one = _mm512_set1_ps(1.0f), zero = _mm512_setzero_ps();
+	for (size_t i = 0; i < n; i += 16)
+	{
+		__mmask16 mask = n - i >= 16 ? __mmask16(0xFFFF) : __mmask16((1u << (n - i)) - 1);
+		__m512 e = expAvx512(_mm512_sub_ps(zero, _mm512_maskz_loadu_ps(mask, z + i)));
+		_mm512_mask_storeu_ps(out + i, mask, _mm512_div_ps(one, _mm512_add_ps(one, e)));
+	}
+}
+
+////////////////////////////////////////
+// softmax, float
+KERNEL_TARGET("avx512f")
+void softmaxAvx512(const float* z, float* out, size_t n)
+{
+	const __m512 lowest = _mm512_set1_ps(std::numeric_limits<float>::lowest());
+	__m512 vmax = lowest, vsum = _mm512_setzero_ps();
+	for (size_t i = 0; i < n; i += 16)
+	{
+		__mmask16 mask = n - i >= 16 ? __mmask16(0xFFFF) : __mmask16((1u << (n - i)) - 1);
+		__m512 x = _mm512_mask_loadu_ps(lowest, mask, z + i);
+		__m512 newMax = _mm512_mask_max_ps(vmax, mask, vmax, x);
+		__m512 e = _mm512_maskz_mov_ps(mask, expAvx512(_mm512_sub_ps(x, newMax)));
+		vsum = _mm512_fmadd_ps(vsum, expAvx512(_mm512_sub_ps(vmax, newMax)), e);
+		vmax = newMax;
+	}
+
+	const float max = _mm512_reduce_max_ps(vmax);
+	const float sum = _mm512_reduce_add_ps(_mm512_mul_ps(vsum, expAvx512(_mm512_sub_ps(vmax, _mm512_set1_ps(max)))));
+
+	const __m512 vscale = _mm512_set1_ps(1 / sum), vmaxAll = _mm512_set1_ps(max);
+	for (size_t i = 0; i < n; i += 16)
+	{
+		__mmask16 mask = n - i >= 16 ? __mmask16(0xFFFF) : __mmask16((1u << (n - i)) - 1);
+		__m512 e = expAvx512(_mm512_sub_ps(_mm512_maskz_loadu_ps(mask, z + i), vmaxAll));
+		_mm512_mask_storeu_ps(out + i, mask, _mm512_mul_ps(e, vscale));
+	}
+}
+
+////////////////////////////////////////
+// momentum update, float
+KERNEL_TARGET("avx512f")
+void momentumAvx512(float rate, const float* g, float mu, float* v, float decay, float* p, size_t n)
+{
+	const __m512 vrate = _mm512_set1_ps(rate), vmu = _mm512_set1_ps(mu), vdecay = _mm512_set1_ps(decay);
+	for (size_t i = 0; i < n; i += 16)
+	{
+		__mmask16 mask = n - i >= 16 ? __mmask16(0xFFFF) : __mmask16((1u << (n - i)) - 1);
+		__m512 vv = _mm512_fmadd_ps(vmu, _mm512_maskz_loadu_ps(mask, v + i), _mm512_mul_ps(vrate, _mm512_maskz_loadu_ps(mask, g + i)));
+		_mm512_mask_storeu_ps(v + i, mask, vv);
+		_mm512_mask_storeu_ps(p + i, mask, _mm512_fmadd_ps(vdecay, _mm512_maskz_loadu_ps(mask, p + i), vv));
+	}
+}
+
+////////////////////////////////////////
+// adam update, float
+KERNEL_TARGET("avx512f")
+void adamAvx512(const AdamStep<float>& step, const float* g, float* m, float* v, float* p, size_t n)
+{
+	const __m512 beta1 = _mm512_set1_ps(step.beta1), mScale = _mm512_set1_ps(step.mScale);
+	const __m512 beta2 = _mm512_set1_ps(step.beta2), vScale = _mm512_set1_ps(step.vScale);
+	const __m512 rate = _mm512_set1_ps(step.rate), epsilon = _mm512_set1_ps(step.epsilon), decay = _mm512_set1_ps(step.decay);
+	for (size_t i = 0; i < n; i += 16)
+	{
+		__mmask16 mask = n - i >= 16 ? __mmask16(0xFFFF) : __mmask16((1u << (n - i)) - 1);
+		__m512 vg = _mm512_maskz_loadu_ps(mask, g + i);
+		__m512 vm = _mm512_fmadd_ps(beta1, _mm512_maskz_loadu_ps(mask, m + i), _mm512_mul_ps(mScale, vg));
+		__m512 vv = _mm512_fmadd_ps(beta2, _mm512_maskz_loadu_ps(mask, v + i), _mm512_mul_ps(vScale, _mm512_mul_ps(vg, vg)));
+		__m512 update = _mm512_div_ps(_mm512_mul_ps(rate, vm), _mm512_add_ps(_mm512_sqrt_ps(vv), epsilon));
+		_mm512_mask_storeu_ps(m + i, mask, vm);
+		_mm512_mask_storeu_ps(v + i, mask, vv);
+		_mm512_mask_storeu_ps(p + i, mask, _mm512_fmadd_ps(decay, _mm512_maskz_loadu_ps(mask, p + i), update));
+	}
+}
+
+////////////////////////////////////////
+// int8 matrix product, same as the avx2 one 32 weights at a time
+KERNEL_TARGET("avx512f,avx512bw,avx2,fma")
+void gemmInt8Avx512(const int16_t* a, const int8_t* b, size_t rows, size_t cols, size_t depth, int32_t* c)
+{
+	for (size_t i = 0; i < rows; i += INT8_ROWS)
+	{
+		const int16_t* a0 = a + i * depth;
+		for (size_t j = 0; j != cols; ++j)
+		{
+			const int8_t* w = b + j * depth;
+			__m512i s[INT8_ROWS] = { _mm512_setzero_si512(), _mm512_setzero_si512(), _mm512_setzero_si512(), _mm512_setzero_si512() };
+			for (size_t k = 0; k < depth; k += 32)
+			{
+				const __m512i vw = _mm512_cvtepi8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + k)));
+				for (size_t r = 0; r != INT8_ROWS; ++r)
+					s[r] = _mm512_add_epi32(s[r], _mm512_madd_epi16(_mm512_loadu_si512(a0 + r * depth + k), vw));
+			}
+
+			__m256i half[INT8_ROWS];
+			for (size_t r = 0; r != INT8_ROWS; ++r)
+				half[r] = _mm256_add_epi32(_mm512_castsi512_si256(s[r]), _mm512_extracti64x4_epi64(s[r], 1));
+			storeInt8Sums(half[0], half[1], half[2], half[3], c + i * cols + j, cols);
+		}
+	}
+}
+
+////////////////////////////////////////
+// int8 quantization of one row, see quantizeInt8Avx2
+KERNEL_TARGET("avx512f,avx512bw,avx2,fma")
+float quantizeInt8Avx512(const float* x, int16_t* q, size_t n, size_t depth)
+{
+	__m512 vmax = _mm512_setzero_ps();
+	for (size_t i = 0; i < n; i += 16)
+	{
+		__mmask16 mask = n - i >= 16 ? __mmask16(0xFFFF) : __mmask16((1u << (n - i)) - 1);
+		vmax = _mm512_max_ps(vmax, _mm512_abs_ps(_mm512_maskz_loadu_ps(mask, x + i)));
+	}
+	const float maxAbs = _mm512_reduce_max_ps(vmax);
+	const float scale = maxAbs > 0.0f ? maxAbs / 127.0f : 1.0f;
+
+	// lanes at or past n load as zero, which fills the padding up to depth
+	const __m512 inverse = _mm512_set1_ps(1.0f / scale);
+	const __m512i sign = _mm512_set1_epi32(int(0x80000000u)), half = _mm512_castps_si512(_mm512_set1_ps(0.5f));
+	for (size_t i = 0; i < depth; i += 16)
+	{
+		__mmask16 mask = i >= n ? __mmask16(0) : n - i >= 16 ? __mmask16(0xFFFF) : __mmask16((1u << (n - i)) - 1);
+		const __m512 v = _mm512_mul_ps(_mm512_maskz_loadu_ps(mask, x + i), inverse);
+		const __m512 rounding = _mm512_castsi512_ps(_mm512_or_si512(_mm512_and_si512(_mm512_castps_si512(v), sign), half));
+		const __m512i r = _mm512_cvttps_epi32(_mm512_add_ps(v, rounding));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(q + i), _mm512_cvtepi32_epi16(r));
+	}
+
+	return scale;
+}
+
+////////////////////////////////////////
+// int8 dequantization of one row
+KERNEL_TARGET("avx512f")
+void dequantizeInt8Avx512(const int32_t* sums, float scale, const float* biases, float* out, size_t n)
+{
+	const __m512 vscale = _mm512_set1_ps(scale);
+	for (size_t i = 0; i < n; i += 16)
+	{
+		__mmask16 mask = n - i >= 16 ? __mmask16(0xFFFF) : __mmask16((1u << (n - i)) - 1);
+		const __m512 v = _mm512_cvtepi32_ps(_mm512_maskz_loadu_epi32(mask, sums + i));
+		_mm512_mask_storeu_ps(out + i, mask, _mm512_fmadd_ps(v, vscale, _mm512_maskz_loadu_ps(mask, biases + i)));
+	}
+}
+
+////////////////////////////////////////
+// cpuid checks, the os also has to save the wider registers (xgetbv)
+bool cpuHasAvx2()
+{
+#if defined(__GNUC__)
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) return false;
+	__cpuidex(info, 1, 0);
+	bool fma = (info[2] & (1 << 12)) != 0, osxsave = (info[2] & (1 << 27)) != 0;
+	if (!fma || !osxsave || (_xgetbv(0) & 0x6) != 0x6) return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return false;
+#endif
+}
+
+bool cpuHasAvx512()
+{
+#if defined(__GNUC__)
+	return __builtin_cpu_supports("avx512f");
+#elif defined(_MSC_VER)
+	if (!cpuHasAvx2() || (_xgetbv(0) & 0xE6) != 0xE6) return false;
+	int info[4];
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 16)) != 0;
+#else
+	return false;
+#endif
+}
+
+bool cpuHasAvx512Bw()
+{
+#if defined(__GNUC__)
+	return __builtin_cpu_supports("avx512bw");
+#elif defined(_MSC_VER)
+	if (!cpuHasAvx512()) return false;
+	int info[4];
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 30)) != 0;
+#else
+	return false;
+#endif
+}
+#endif // KERNELS_X86
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// DISPATCH
+////////////////////////////////////////
+// returns the fastest kernels this cpu supports for T, chosen on first call
+template <typename T>
+const Kernels<T>& kernels()
+{
+	static const Kernels<T> selected = [] {
+		Kernels<T> k = { dotScalar<T>, axpbyScalar<T>, sigmoidScalar<T>, softmaxScalar<T>, momentumScalar<T>, adamScalar<T>, "scalar" };
+#ifdef KERNELS_X86
+		if (cpuHasAvx512())
+			k = { dotAvx512, axpbyAvx512, sigmoidAvx512, softmaxAvx512, momentumAvx512, adamAvx512, "avx512" };
+		else if (cpuHasAvx2())
+			k = { dotAvx2, axpbyAvx2, sigmoidAvx2, softmaxAvx2, momentumAvx2, adamAvx2, "avx2" };
+#endif
+		return k;
+	}();
+
+	return selected;
+}
+
+////////////////////////////////////////
+// returns the fastest int8 kernels this cpu supports, chosen on first call
+const Int8Kernels& int8Kernels()
+{
+	static const Int8Kernels selected = [] {
+		Int8Kernels k = { gemmInt8Scalar, quantizeInt8Scalar, dequantizeInt8Scalar, "scalar" };
+#ifdef KERNELS_X86
+		if (cpuHasAvx512() && cpuHasAvx512Bw())
+			k = { gemmInt8Avx512, quantizeInt8Avx512, dequantizeInt8Avx512, "avx512bw" };
+		else if (cpuHasAvx2())
+			k = { gemmInt8Avx2, quantizeInt8Avx2, dequantizeInt8Avx2, "avx2" };
+#endif
+		return k;
+	}();
+
+	return selected;
+}
+
+#endif // KERNELS_H
@@ -6,29 +6,45 @@
 // DATE:        10/20/2019
 
 #include "config.h"
-#include "network.h"
+#include "quantized_network.h"
 
 int main()
 {
 	// set up network
 	Network net(LAYERS_SIZES, STEP_CONSTANT, LAMBDA);
+	net.setThreads(TRAINING_THREADS);
+	if (SOFTMAX_OUTPUTS)
+		net.setOutput(SOFTMAX_OUTPUT);
 
 	// set up random generator
 	std::default_random_engine generator;
 	std::uniform_int_distribution<int> distribution(0, INPUTS - 1);
 	auto rand = std::bind(distribution, generator);
 
-	// set up training data
-	valarray<ValD> Xtrain(ValD(0.0, INPUTS), TRAIN_DATA_SIZE);
-	ValD Ytrain(TRAIN_DATA_SIZE);
-	for (size_t i = 0; i != Xtrain.size(); ++i)
+	// set up training data, written straight to a dataset file one sample at a time
+	{
+		DatasetWriter writer(TRAIN_DATA_FILE, INPUTS);
+		ValD sample(0.0, INPUTS);
+		for (size_t i = 0; i != TRAIN_DATA_SIZE; ++i)
+		{
+			int ans = rand();
+			sample = 0;
+			sample[ans] = 1;
+			writer.add(&sample[0], ans % OUTPUTS);
+		}
+	}
+	Dataset train(TRAIN_DATA_FILE);
+
+	// set up validation and test data
+	valarray<ValD> Xval(ValD(0.0, INPUTS), VALIDATION_DATA_SIZE);
+	ValD Yval(0.0, VALIDATION_DATA_SIZE);
+	for (size_t i = 0; i != Xval.size(); ++i)
 	{
 		int ans = rand();
-		Xtrain[i][ans] = 1;
-		Ytrain[i] = ans % OUTPUTS;
+		Xval[i][ans] = 1;
+		Yval[i] = ans % OUTPUTS;
 	}
 
-	// set up test data
 	valarray<ValD> Xtest(ValD(0.0, INPUTS), TEST_DATA_SIZE);
 	ValD Ytest(0.0, TEST_DATA_SIZE);
 	for (size_t i = 0; i != Xtest.size(); ++i)
@@ -46,8 +62,13 @@ int main()
 	cout << "Initial weights and biases: " << endl;
 	net.print();
 
-	// train network
-	net.train(Xtrain, Ytrain, TRAINING_EPOCHS);
+	// train network, stopping once the validation loss stops improving
+	EarlyStopping stopping;
+	stopping.interval = VALIDATION_INTERVAL;
+	stopping.patience = VALIDATION_PATIENCE;
+	TrainingReport report = net.train(train, TRAINING_EPOCHS, BATCH_SIZE, Xval, Yval, stopping);
+	cout << "Trained " << report.epochs << " epochs" << (report.stoppedEarly ? " before stopping early" : "")
+		<< ", kept epoch " << report.bestEpoch << " with validation loss " << report.bestLoss << endl << endl;
 
 	// test and output results after training
 	cout << "Percent of success AFTER training: " 
@@ -56,4 +77,26 @@ int main()
 	// output network
 	cout << "New weights and biases after training: " << endl;
 	net.print();
+
+	// compare against an int8 copy for inference
+	QuantizedNetwork quant(net);
+	quantizationReport(net, quant, Xtest, Ytest, TEST_DATA_SIZE);
+
+	// save network so it can be loaded without retraining
+	net.save(MODEL_FILE);
+
+	// load it back and keep training the loaded copy
+	Network loaded = Network::load(MODEL_FILE);
+	loaded.setThreads(TRAINING_THREADS);
+	cout << "Percent of success LOADED from " << MODEL_FILE << ": "
+		<< loaded.test(Xtest, Ytest, TEST_DATA_SIZE) * 100.0 << '%' << endl;
+	loaded.train(train, TRAINING_EPOCHS, BATCH_SIZE);
+	cout << "Percent of success after training the loaded copy: "
+		<< loaded.test(Xtest, Ytest, TEST_DATA_SIZE) * 100.0 << '%' << endl << endl;
+
+#ifdef NETWORK_PROFILING
+	// per epoch time, throughput, loss and accuracy of training
+	net.telemetry().writeCsv(TELEMETRY_CSV_FILE);
+	net.telemetry().writeJson(TELEMETRY_JSON_FILE);
+#endif
 }
@@ -5,52 +5,165 @@
 //
 // FILE:        network.h
 // DESCRIPTION: contains Network class and implementation, uses valarrays
+//              the network is templated on its scalar type, Network trains
+//              in double and NetworkF in float
 // AUTHOR:      Dan Fabian
 // DATE:        10/20/2019
 
 #include "network_utility.h"
+#include "optimizer.h"
+#include "dataset.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
 #include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <functional>
+#include <future>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
 
 using std::cout; using std::endl;
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// MODEL FILE
+// notes: binary layout, every value in native byte order
+//        char[8]   magic "NNMODEL"
+//        uint32    version
+//        uint32    number of layers L + 1
+//        uint32    bytes per scalar, 8 for Network and 4 for NetworkF
+//        uint32    output layer, 0 for sigmoid and 1 for softmax
+//        uint64    size of every layer, input layer first
+//        double    step constant, lambda
+//        then for layers 1 .. L: the row-major weights followed by the biases
+//        stored as the network's scalar type, padded to a multiple of 8 bytes
+//        every field starts on an 8 byte boundary so the weights stay aligned
+const char     MODEL_MAGIC[8] = { 'N', 'N', 'M', 'O', 'D', 'E', 'L', '\0' };
+const uint32_t MODEL_VERSION = 2;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// EARLY STOPPING
+// notes: every interval epochs a snapshot of the weights is scored on the
+//        validation set by a separate thread while training carries on, the
+//        result is collected at the next check so training never waits on it
+//        training stops after patience checks in a row without the loss
+//        dropping by more than minDelta, and the best snapshot is restored
+struct EarlyStopping {
+	size_t interval = 10; // epochs between validation checks
+	size_t patience = 5;  // checks without improvement before training stops
+	double minDelta = 0;  // smallest drop in validation loss that counts as improvement
+};
+
+struct TrainingReport {
+	size_t epochs = 0;        // epochs actually trained
+	size_t bestEpoch = 0;     // epoch the kept weights were taken at, 0 for the starting weights
+	double bestLoss = 0;      // validation loss of the kept weights
+	size_t checks = 0;        // validation checks scored
+	bool   stoppedEarly = false;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // NETWORK
-class Network {
+// notes: T is the type weights, biases and activations are stored and computed
+//        in, inputs and outputs of the public methods are always double
+template <typename T>
+class BasicNetwork {
 public:
-	// constructor
-	Network(vector<size_t> layerSizes, double stepConst, double lambda);
+	typedef valarray<T> ValT;
+
+	// constructors
+	BasicNetwork(vector<size_t> layerSizes, double stepConst, double lambda);
+	BasicNetwork(const BasicNetwork& other);            // the copy gets its own optimizer state
+	BasicNetwork(BasicNetwork&&) = default;
+	BasicNetwork& operator=(const BasicNetwork& other);
+	BasicNetwork& operator=(BasicNetwork&&) = default;
 
 	// methods
-	void   train     (const valarray<ValD>& Xdata, const ValD& Ydata, const size_t& epochs); // trains the whole network
-	double test      (const valarray<ValD>& Xdata, const ValD& Ydata, const size_t& epochs); // tests the network and returns a decimal of correct answers / total
-	void   dropout   (size_t layer, size_t toDrop);                                          // randomly chooses toDrop amount of neurons to dropout in layer
+	void   train     (const valarray<ValD>& Xdata, const ValD& Ydata, const size_t& epochs,
+	                  const size_t& batchSize = 1);                                          // trains the whole network, one batch per epoch
+	void   train     (const Dataset& data, const size_t& epochs, const size_t& batchSize);   // same, batches are streamed from data by a prefetch thread
+	TrainingReport train (const valarray<ValD>& Xdata, const ValD& Ydata, const size_t& epochs, const size_t& batchSize,
+	                      const valarray<ValD>& Xval, const ValD& Yval, const EarlyStopping& stopping); // trains until the validation loss stops improving
+	TrainingReport train (const Dataset& data, const size_t& epochs, const size_t& batchSize,
+	                      const valarray<ValD>& Xval, const ValD& Yval, const EarlyStopping& stopping); // same, batches are streamed from data
+	double test      (const valarray<ValD>& Xdata, const ValD& Ydata,
+	                  const size_t& epochs) const;                                           // tests the network and returns a decimal of correct answers / total
+	double loss      (const valarray<ValD>& Xdata, const ValD& Ydata,
+	                  const size_t& count) const;                                            // mean cross entropy of the first count samples
+	vector<size_t> predict       (const valarray<ValD>& Xdata) const;                       // returns the argmax output neuron of every sample
+	valarray<ValD> probabilities (const valarray<ValD>& Xdata) const;                       // returns the output layer activations of every sample
+	void   dropout   (size_t layer, double rate);                                            // drops each neuron of hidden layer with probability rate on every training step
 	void   setLambda (double lambda) { lambda_ = lambda; }
 	void   setStep   (double step)   { stepConstant_ = step; }
+	void   setThreads(size_t threads);                                                       // threads used to split each training batch
+	void   setOutput (OutputLayer output) { output_ = output; }                            // sigmoid unless set
+	void   setOptimizer (const Optimizer<T>& optimizer) { optimizer_.reset(optimizer.clone()); } // sgd unless set, training state starts over
 	void   print     () const;
+	void   save      (const string& file) const;                                             // writes the network to a binary model file
+	static BasicNetwork load (const string& file);                                           // maps a model file, weights are read in place until trained
+
+	const vector<Layer<T>>& layers () const { return layers_; }
+	OutputLayer             output () const { return output_; }
+	NETWORK_PROFILE(Telemetry&       telemetry ()       { return telemetry_; }) // per epoch training summary, see profiler.h
+	NETWORK_PROFILE(const Telemetry& telemetry () const { return telemetry_; })
 
 private:
 	// helper functions
-	void backPropagation    (const ValD& alpha, const ValD& Yvalue); // uses backprop to adjust weights and biases
-	ValD forwardPropagation (const ValD& inputs);                    // returns a valarray of output layer activations
-
-	vector<Layer> layers_;
-	vector<ValD>  z_; // need to store z values after each forward prop to be used in back prop alg
-	double        stepConstant_;
-	double        lambda_;
-	size_t        trainingSetSize_;
+	void        backPropagation    (Workspace<T>& work);                              // uses backprop on work.target to find the gradients in work
+	const ValT& forwardPropagation (const ValD& inputs, Workspace<T>& work,
+	                                bool training = false) const;                     // returns the output layer activations stored in work
+
+	void batchForwardPropagation (const T* inputs, size_t rows, BatchWorker<T>& worker,
+	                              bool training = false) const;                              // fills worker activations for rows inputs
+	void batchGradients          (const T* inputs, const T* Yrows, size_t rows,
+	                              BatchWorker<T>& worker) const;                             // sums gradients of rows samples into worker
+	void prepareTraining         (size_t trainingSetSize, size_t batchSize);                 // detaches the weights and sizes optimizer and worker buffers
+	void trainBatch              (const T* Xbatch, const T* Ybatch, size_t batchSize);       // one step over a batch laid out one row per sample
+	std::function<void()> sampler (const valarray<ValD>& Xdata, const ValD& Ydata,
+	                               size_t batchSize);                                         // prepares training, returns a step over one random batch
+	TrainingReport trainValidated (size_t epochs, const std::function<void()>& step, const valarray<ValD>& Xval,
+	                               const ValD& Yval, const EarlyStopping& stopping);          // runs step until epochs or the validation loss plateaus
+	void applyGradients          (size_t batchSize);                                         // reduces worker gradients and adjusts weights and biases
+	void updateLayers            (const vector<ValT>& weightGrads, const vector<ValT>& biasGrads,
+	                              double scale);                                             // hands scale * gradients of every layer to the optimizer
+	void batchPredict            (const valarray<ValD>& Xdata, size_t count, T* outputs) const; // output activations of the first count samples, row-major
+	void detach                  ();                                                         // copies mapped weights so they can be trained
+
+	vector<Layer<T>>            layers_;
+	Workspace<T>                workspace_; // buffers for single sample training
+	vector<BatchWorker<T>>      workers_; // one set of buffers per thread, so shards never share state
+	std::shared_ptr<ThreadPool> pool_;
+	std::shared_ptr<Optimizer<T>> optimizer_;
+	std::shared_ptr<MappedFile> mapping_; // model file the layers read from, null once detached
+	vector<double>              keep_; // keep_[l] is the probability a neuron of layer l survives dropout
+	OutputLayer                 output_;
+	double                      stepConstant_;
+	double                      lambda_;
+	size_t                      trainingSetSize_;
+	NETWORK_PROFILE(Telemetry           telemetry_;)
 };
 
+typedef BasicNetwork<double> Network;
+typedef BasicNetwork<float>  NetworkF;
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // NETWORK functions
 ////////////////////////////////////////
 // constructor
-Network::Network(vector<size_t> layerSizes, double stepConst, double lambda) :
-	layers_(vector<Layer>(layerSizes.size())),
-	z_(vector<ValD>(layerSizes.size())),
+template <typename T>
+BasicNetwork<T>::BasicNetwork(vector<size_t> layerSizes, double stepConst, double lambda) :
+	layers_(vector<Layer<T>>(layerSizes.size())),
+	optimizer_(std::make_shared<Sgd<T>>()),
+	keep_(vector<double>(layerSizes.size(), 1.0)),
+	output_(SIGMOID_OUTPUT),
 	stepConstant_(stepConst),
 	lambda_(lambda),
 	trainingSetSize_(0)
@@ -58,171 +171,609 @@ Network::Network(vector<size_t> layerSizes, double stepConst, double lambda) :
 	// init layers, start from 1 since 0 is the input layer which doesn't have weights or biases
 	layers_[0].size_ = layerSizes[0];
 	for (size_t i = 1; i != layers_.size(); ++i)
-		layers_[i] = Layer(layerSizes[i - 1], layerSizes[i]);
+		layers_[i] = Layer<T>(layerSizes[i - 1], layerSizes[i]);
+
+	workspace_ = Workspace<T>(layerSizes);
+	setThreads(1);
+}
+
+////////////////////////////////////////
+// copy constructor, the optimizer is cloned so the moments of the copy and
+// the original never mix, the thread pool and a mapped model file are shared
+template <typename T>
+BasicNetwork<T>::BasicNetwork(const BasicNetwork& other) :
+	layers_(other.layers_),
+	workspace_(other.workspace_),
+	workers_(other.workers_),
+	pool_(other.pool_),
+	optimizer_(other.optimizer_->clone()),
+	mapping_(other.mapping_),
+	keep_(other.keep_),
+	output_(other.output_),
+	stepConstant_(other.stepConstant_),
+	lambda_(other.lambda_),
+	trainingSetSize_(other.trainingSetSize_)
+{
+	NETWORK_PROFILE(telemetry_ = other.telemetry_;)
+}
+
+////////////////////////////////////////
+// copy assignment, see the copy constructor
+template <typename T>
+BasicNetwork<T>& BasicNetwork<T>::operator=(const BasicNetwork& other)
+{
+	if (this != &other)
+		*this = BasicNetwork(other);
+
+	return *this;
+}
+
+////////////////////////////////////////
+// sets the number of threads each training batch is split across
+template <typename T>
+void BasicNetwork<T>::setThreads(size_t threads)
+{
+	if (threads == 0)
+		threads = 1;
+
+	pool_ = std::make_shared<ThreadPool>(threads);
+	workers_.assign(threads, BatchWorker<T>());
+	for (size_t t = 0; t != threads; ++t)
+	{
+		workers_[t].generator.seed(unsigned(t + 1)); // every worker draws its own dropout masks
+		workers_[t].weightGrads.resize(layers_.size());
+		workers_[t].biasGrads.resize(layers_.size());
+		for (size_t l = 1; l != layers_.size(); ++l)
+		{
+			workers_[t].weightGrads[l].resize(layers_[l].size_ * layers_[l].stride_);
+			workers_[t].biasGrads[l].resize(layers_[l].size_);
+		}
+	}
 }
 
 ////////////////////////////////////////
 // forward propagation, returns a valarray of output layer activations
-ValD Network::forwardPropagation(const ValD& inputs)
+// the activations of every layer are kept in work for the backprop function,
+// while training they are kept after dropout
+template <typename T>
+const typename BasicNetwork<T>::ValT& BasicNetwork<T>::forwardPropagation(const ValD& inputs, Workspace<T>& work, bool training) const
 {
-	// alpha is the activation from the previous neuron
-	// input layer
-	ValD alpha = inputs;
+	PROFILE_SCOPE(work.counters, PHASE_FORWARD);
 
-	// also store inputs in z_[0] for use in backprop function
-	z_[0] = inputs;
+	// alpha[0] is the input layer
+	for (size_t i = 0; i != layers_[0].size_; ++i)
+		work.alpha[0][i] = T(inputs[i]);
 
 	// begin progatating forward, layer 0 is the input layer so start at layer 1
 	for (size_t l = 1; l != layers_.size(); ++l)
 	{
-		ValD z(layers_[l].size_);
+		const T* prev = &work.alpha[l - 1][0];
+		T* alpha = &work.alpha[l][0];
 		for (size_t j = 0; j != layers_[l].size_; ++j) // finding z for the j-th neuron in the l-th layer
-			z[j] = (layers_[l].weights_[j] * alpha).sum() + layers_[l].biases_[j];
-
-		// save z values
-		z_[l] = z;
+			alpha[j] = dot(layers_[l].row(j), prev, layers_[l].stride_) + layers_[l].biases()[j];
 
 		// get activations
-		alpha = sigmoid(z);
+		if (l == layers_.size() - 1)
+			activateOutputs(output_, alpha, 1, layers_[l].size_);
+		else
+			sigmoid(alpha, alpha, layers_[l].size_);
+		if (training && keep_[l] < 1.0)
+			dropoutMask(alpha, layers_[l].size_, keep_[l], work.generator);
 	}
 
-	return alpha;
+	return work.alpha.back();
 }
 
 ////////////////////////////////////////
-// back propagation algorithm to adjust weights and biases in each layer
-void Network::backPropagation(const ValD& alpha, const ValD& Yvalue)
+// back propagation algorithm to find the weight and bias gradients of each layer,
+// expects work to hold the forward pass of the sample and its expected output
+template <typename T>
+void BasicNetwork<T>::backPropagation(Workspace<T>& work)
 {
-	// init vector of deltas for each layer
+	PROFILE_SCOPE(work.counters, PHASE_BACKPROP);
+
 	const size_t L = layers_.size() - 1; // final layer
-	valarray<ValD> delta(L + 1);
+	const ValT& alpha = work.alpha[L];
+	const ValT& Yvalue = work.target;
+	vector<ValT>& delta = work.delta;
 
-	// begin with delta in the output layer
-	delta[L] = Yvalue * (1.0 - alpha) - alpha * (1.0 - Yvalue);
+	// begin with delta in the output layer, Y - a for either output layer
+	for (size_t j = 0; j != layers_[L].size_; ++j)
+		delta[L][j] = Yvalue[j] * (1 - alpha[j]) - alpha[j] * (1 - Yvalue[j]);
 
 	// now propagate backward to find deltas
 	for (size_t l = L - 1; l > 0; --l)
 	{
-		ValD deltaSum(0.0, layers_[l].size_);
+		ValT& deltaSum = delta[l];
+		deltaSum = 0;
 		for (size_t k = 0; k != layers_[l + 1].size_; ++k)
-			deltaSum += layers_[l + 1].weights_[k] * delta[l + 1][k] * sigmoidPrime(z_[l]);
+			axpby(delta[l + 1][k], layers_[l + 1].row(k), T(1), &deltaSum[0], layers_[l].size_);
+
+		// sigmoid'(z) = a * (1 - a), applied once per layer from the stored activations
+		// with dropout the stored activation is a / keep or 0 and the derivative
+		// picks up the same factor, which works out to a * (1 - a * keep)
+		const ValT& a = work.alpha[l];
+		const T keep = T(keep_[l]);
+		for (size_t i = 0; i != layers_[l].size_; ++i)
+			deltaSum[i] *= a[i] * (1 - a[i] * keep);
+	}
 
-		delta[l] = deltaSum;
+	// weight gradients are the outer product of delta and the previous
+	// activations, the bias gradients are delta itself
+	for (size_t l = 1; l != layers_.size(); ++l)
+	{
+		const T* activation = &work.alpha[l - 1][0];
+		const size_t stride = layers_[l].stride_;
+		for (size_t j = 0; j != layers_[l].size_; ++j)
+			axpby(delta[l][j], activation, T(0), &work.weightGrads[l][j * stride], stride);
 	}
+}
 
-	// adjust weights and biases
+////////////////////////////////////////
+// forward propagation over rows samples stored row-major in inputs
+// each layer is one matrix-matrix product: Z = A_prev * W^T + biases
+// while training the activations are kept after dropout
+template <typename T>
+void BasicNetwork<T>::batchForwardPropagation(const T* inputs, size_t rows, BatchWorker<T>& worker, bool training) const
+{
+	const T* prev = inputs;
 	for (size_t l = 1; l != layers_.size(); ++l)
 	{
-		layers_[l].biases_ += stepConstant_ * delta[l];
-		ValD activation = sigmoid(z_[l - 1]);
+		const Layer<T>& layer = layers_[l];
+		T* alpha = &worker.alpha[l][0];
+
+		// start every row from the biases then accumulate the weighted inputs
+		for (size_t i = 0; i != rows; ++i)
+			std::copy(layer.biases(), layer.biases() + layer.size_, alpha + i * layer.size_);
+		gemm(false, true, rows, layer.size_, layer.stride_, T(1), prev, layer.weights(), alpha);
+
+		if (l == layers_.size() - 1)
+			activateOutputs(output_, alpha, rows, layer.size_);
+		else
+			sigmoid(alpha, alpha, rows * layer.size_);
+		if (training && keep_[l] < 1.0)
+			dropoutMask(alpha, rows * layer.size_, keep_[l], worker.generator);
+		prev = alpha;
+	}
+}
 
-		for (size_t j = 0; j != layers_[l].size_; ++j)
+////////////////////////////////////////
+// runs forward and back propagation over rows samples and stores the summed
+// weight and bias gradients in worker, the network itself is left untouched
+template <typename T>
+void BasicNetwork<T>::batchGradients(const T* inputs, const T* Yrows, size_t rows, BatchWorker<T>& worker) const
+{
+	const size_t L = layers_.size() - 1; // final layer
+	{
+		PROFILE_SCOPE(worker.counters, PHASE_FORWARD);
+		batchForwardPropagation(inputs, rows, worker, true);
+	}
+	PROFILE_SCOPE(worker.counters, PHASE_BACKPROP);
+
+	// delta in the output layer, Y - a for either output layer
+	const T* alphaL = &worker.alpha[L][0];
+	T* deltaL = &worker.delta[L][0];
+	NETWORK_PROFILE(recordOutputs(alphaL, Yrows, rows, layers_[L].size_, output_ == SOFTMAX_OUTPUT, worker.counters));
+	for (size_t i = 0; i != rows * layers_[L].size_; ++i)
+		deltaL[i] = Yrows[i] * (1 - alphaL[i]) - alphaL[i] * (1 - Yrows[i]);
+
+	// propagate backward, D_l = (D_l+1 * W_l+1) .* sigmoid'(z_l)
+	for (size_t l = L - 1; l > 0; --l)
+	{
+		const size_t n = rows * layers_[l].size_;
+		T* delta = &worker.delta[l][0];
+		const T* alpha = &worker.alpha[l][0];
+		std::fill(delta, delta + n, T(0));
+
+		gemm(false, false, rows, layers_[l].size_, layers_[l + 1].size_, T(1),
+			&worker.delta[l + 1][0], layers_[l + 1].weights(), delta);
+
+		// sigmoid'(z) = a * (1 - a), reuse the activations from the forward pass
+		// a * (1 - a * keep) also covers the dropout scaling, see backPropagation
+		const T keep = T(keep_[l]);
+		for (size_t i = 0; i != n; ++i)
+			delta[i] *= alpha[i] * (1 - alpha[i] * keep);
+	}
+
+	// gradients, dW = D^T * A_prev and db = column sums of D
+	for (size_t l = 1; l != layers_.size(); ++l)
+	{
+		const size_t size = layers_[l].size_;
+		const T* delta = &worker.delta[l][0];
+		const T* prev = l == 1 ? inputs : &worker.alpha[l - 1][0];
+
+		worker.biasGrads[l] = 0;
+		for (size_t i = 0; i != rows; ++i)
+			for (size_t j = 0; j != size; ++j)
+				worker.biasGrads[l][j] += delta[i * size + j];
+
+		worker.weightGrads[l] = 0;
+		gemm(true, false, size, layers_[l].stride_, rows, T(1), delta, prev, &worker.weightGrads[l][0]);
+	}
+}
+
+////////////////////////////////////////
+// sums the gradients of every worker into the first and adjusts the weights
+// and biases with the mean gradient of the batch
+template <typename T>
+void BasicNetwork<T>::applyGradients(size_t batchSize)
+{
+	const size_t shards = std::min(workers_.size(), batchSize);
+	for (size_t l = 1; l != layers_.size(); ++l)
+	{
+		// reduce in a fixed order so results don't depend on thread timing
+		ValT& weightGrads = workers_[0].weightGrads[l];
+		ValT& biasGrads = workers_[0].biasGrads[l];
+		for (size_t t = 1; t < shards; ++t)
 		{
-			double deltaAndRatio = stepConstant_ * delta[l][j];
-			double regularization = lambda_ / trainingSetSize_;
+			weightGrads += workers_[t].weightGrads[l];
+			biasGrads += workers_[t].biasGrads[l];
+		}
+	}
+	NETWORK_PROFILE(for (size_t t = 0; t < shards; ++t) { telemetry_.counters().add(workers_[t].counters); workers_[t].counters.clear(); })
+
+	updateLayers(workers_[0].weightGrads, workers_[0].biasGrads, 1.0 / batchSize);
+}
 
-			if (l - 1 != 0)
-				layers_[l].weights_[j] += deltaAndRatio * activation + regularization * layers_[l].weights_[j];
-			else
-				layers_[l].weights_[j] += deltaAndRatio * z_[l - 1] + regularization * layers_[l].weights_[j]; // doesn't need sigmoid since its the raw input
+////////////////////////////////////////
+// one optimizer step over every layer, weights are regularized and biases aren't
+template <typename T>
+void BasicNetwork<T>::updateLayers(const vector<ValT>& weightGrads, const vector<ValT>& biasGrads, double scale)
+{
+	PROFILE_SCOPE(telemetry_.counters(), PHASE_UPDATE);
+	const double regularization = lambda_ / trainingSetSize_;
+
+	optimizer_->begin();
+	for (size_t l = 1; l != layers_.size(); ++l)
+	{
+		Layer<T>& layer = layers_[l];
+		optimizer_->update(2 * l, &layer.weights_[0], &weightGrads[l][0], layer.weights_.size(), stepConstant_, scale, regularization);
+		optimizer_->update(2 * l + 1, &layer.biases_[0], &biasGrads[l][0], layer.size_, stepConstant_, scale, 0.0);
+	}
+}
+
+////////////////////////////////////////
+// detaches mapped weights, sizes the optimizer state and the buffers every
+// worker needs for its shard of a batch
+template <typename T>
+void BasicNetwork<T>::prepareTraining(size_t trainingSetSize, size_t batchSize)
+{
+	detach();
+	trainingSetSize_ = trainingSetSize;
+
+	// one optimizer slot for the weights and one for the biases of every layer
+	vector<size_t> slotSizes(2 * layers_.size(), 0);
+	for (size_t l = 1; l != layers_.size(); ++l)
+	{
+		slotSizes[2 * l] = layers_[l].weights_.size();
+		slotSizes[2 * l + 1] = layers_[l].size_;
+	}
+	optimizer_->resize(slotSizes);
+
+	// split the batch into one contiguous shard per thread and size each
+	// worker's activation and delta buffers for its largest possible shard
+	const size_t shards = std::min(workers_.size(), batchSize);
+	const size_t shardRows = (batchSize + shards - 1) / shards;
+	for (size_t t = 0; t != shards; ++t)
+	{
+		workers_[t].alpha.resize(layers_.size());
+		workers_[t].delta.resize(layers_.size());
+		for (size_t l = 1; l != layers_.size(); ++l)
+		{
+			workers_[t].alpha[l].resize(shardRows * layers_[l].size_);
+			workers_[t].delta[l].resize(shardRows * layers_[l].size_);
 		}
 	}
 }
 
 ////////////////////////////////////////
-// trains the whole network
-void Network::train(const valarray<ValD>& Xdata, const ValD& Ydata, const size_t& epochs)
+// one training step over batchSize samples, every worker computes gradients
+// over its own rows of the batch before they are applied
+template <typename T>
+void BasicNetwork<T>::trainBatch(const T* Xbatch, const T* Ybatch, size_t batchSize)
+{
+	const size_t inputs = layers_[0].size_, outputs = layers_.back().size_;
+	const size_t shards = std::min(workers_.size(), batchSize);
+	pool_->run(shards, [&](size_t t) {
+		const size_t first = t * batchSize / shards, last = (t + 1) * batchSize / shards;
+		batchGradients(Xbatch + first * inputs, Ybatch + first * outputs, last - first, workers_[t]);
+	});
+
+	applyGradients(batchSize); // adjust weights
+	NETWORK_PROFILE(telemetry_.endEpoch());
+}
+
+////////////////////////////////////////
+// prepares training on Xdata and returns a step that trains on batchSize
+// random samples, a batch size of 1 runs plain stochastic gradient descent
+// one sample at a time
+template <typename T>
+std::function<void()> BasicNetwork<T>::sampler(const valarray<ValD>& Xdata, const ValD& Ydata, size_t batchSize)
 {
 	// set up random generator
 	std::default_random_engine generator;
 	std::uniform_int_distribution<int> distribution(0, Xdata.size() - 1);
 	auto rand = std::bind(distribution, generator);
 
-	trainingSetSize_ = Xdata.size();
+	const size_t inputs = layers_[0].size_, outputs = layers_.back().size_;
+	prepareTraining(Xdata.size(), std::max(batchSize, size_t(1)));
+	if (batchSize <= 1)
+		return [=, &Xdata, &Ydata]() mutable {
+			size_t index = rand(); // select a random piece of data to train with
+			forwardPropagation(Xdata[index], workspace_, true);
+			workspace_.target = 0;
+			workspace_.target[size_t(Ydata[index])] = 1; // set correct answer
+
+			backPropagation(workspace_);
+			NETWORK_PROFILE(recordOutputs(&workspace_.alpha.back()[0], &workspace_.target[0], 1, outputs, output_ == SOFTMAX_OUTPUT, workspace_.counters));
+			NETWORK_PROFILE(telemetry_.counters().add(workspace_.counters); workspace_.counters.clear());
+
+			updateLayers(workspace_.weightGrads, workspace_.delta, 1.0); // adjust weights
+			NETWORK_PROFILE(telemetry_.endEpoch());
+		};
+
+	// batch buffers, inputs and expected outputs are stored one row per sample
+	ValT Xbatch(batchSize * inputs), Ybatch(batchSize * outputs);
+	return [=, &Xdata, &Ydata]() mutable {
+		Ybatch = 0;
+		for (size_t i = 0; i != batchSize; ++i)
+		{
+			size_t index = rand(); // select a random piece of data to train with
+			std::copy(&Xdata[index][0], &Xdata[index][0] + inputs, &Xbatch[i * inputs]);
+			Ybatch[i * outputs + size_t(Ydata[index])] = 1; // set correct answer
+		}
+
+		trainBatch(&Xbatch[0], &Ybatch[0], batchSize);
+	};
+}
+
+////////////////////////////////////////
+// trains the whole network, each epoch trains on batchSize random samples
+// a batch size of 1 runs plain stochastic gradient descent one sample at a time
+template <typename T>
+void BasicNetwork<T>::train(const valarray<ValD>& Xdata, const ValD& Ydata, const size_t& epochs, const size_t& batchSize)
+{
+	std::function<void()> step = sampler(Xdata, Ydata, batchSize);
 	for (size_t ep = 0; ep < epochs; ++ep)
-	{
-		size_t index = rand(); // select a random piece of data to train with
-		ValD alpha = forwardPropagation(Xdata[index]);
-		ValD ans(0.0, alpha.size());
-		ans[Ydata[index]] = 1.0; // set correct answer
+		step();
+}
 
-		backPropagation(alpha, ans); // adjust weights
+////////////////////////////////////////
+// trains the whole network on batches streamed from data, a prefetch thread
+// shuffles and assembles the next batches while the current one trains
+template <typename T>
+void BasicNetwork<T>::train(const Dataset& data, const size_t& epochs, const size_t& batchSize)
+{
+	if (data.inputs() != layers_[0].size_)
+		throw std::runtime_error("dataset inputs don't match the input layer");
+
+	const size_t rows = std::max(batchSize, size_t(1));
+	prepareTraining(data.size(), rows);
+
+	BatchStream<T> stream(data, rows, layers_.back().size_);
+	for (size_t ep = 0; ep < epochs; ++ep)
+	{
+		const Batch<T>& batch = stream.next();
+		trainBatch(&batch.X[0], &batch.Y[0], rows);
 	}
 }
 
 ////////////////////////////////////////
-// tests the network and returns a decimal of correct answers / total
-double Network::test(const valarray<ValD>& Xdata, const ValD& Ydata, const size_t& epochs)
+// trains like train above for at most epochs, stops early once the loss on
+// Xval stops improving and keeps the weights that scored best on it
+template <typename T>
+TrainingReport BasicNetwork<T>::train(const valarray<ValD>& Xdata, const ValD& Ydata, const size_t& epochs, const size_t& batchSize,
+	const valarray<ValD>& Xval, const ValD& Yval, const EarlyStopping& stopping)
 {
-	size_t success = 0;
-	for (size_t i = 0; i != epochs; ++i)
-	{
-		ValD alpha = forwardPropagation(Xdata[i]);
+	return trainValidated(epochs, sampler(Xdata, Ydata, batchSize), Xval, Yval, stopping);
+}
 
-		// find argmax
-		size_t argmax = 0;
-		for (size_t j = 1; j != alpha.size(); ++j)
-			if (alpha[argmax] < alpha[j])
-				argmax = j;
+////////////////////////////////////////
+// same, batches are streamed from data by a prefetch thread
+template <typename T>
+TrainingReport BasicNetwork<T>::train(const Dataset& data, const size_t& epochs, const size_t& batchSize,
+	const valarray<ValD>& Xval, const ValD& Yval, const EarlyStopping& stopping)
+{
+	if (data.inputs() != layers_[0].size_)
+		throw std::runtime_error("dataset inputs don't match the input layer");
 
-		if (argmax == Ydata[i])
-			++success;
-	}
+	const size_t rows = std::max(batchSize, size_t(1));
+	prepareTraining(data.size(), rows);
 
-	return double(success) / double(epochs);
+	BatchStream<T> stream(data, rows, layers_.back().size_);
+	return trainValidated(epochs, [&]() {
+		const Batch<T>& batch = stream.next();
+		trainBatch(&batch.X[0], &batch.Y[0], rows);
+	}, Xval, Yval, stopping);
 }
 
 ////////////////////////////////////////
-// randomly chooses toDrop amount of neurons to dropout in layer
-void Network::dropout(size_t layer, size_t toDrop)
+// runs step for at most epochs, see EARLY STOPPING, the validation thread
+// scores its own copy of the network so it never touches the one training
+template <typename T>
+TrainingReport BasicNetwork<T>::trainValidated(size_t epochs, const std::function<void()>& step, const valarray<ValD>& Xval,
+	const ValD& Yval, const EarlyStopping& stopping)
 {
-	if (layer == 0 || layer >= layers_.size() - 1) // can't dropout in the input layer or output layer
-		return;
+	if (Xval.size() == 0 || Xval.size() != Yval.size())
+		throw std::invalid_argument("early stopping needs a validation set with one label per sample");
+
+	// the validator gets a single thread pool so scoring runs on the validation thread only
+	BasicNetwork validator(*this);
+	validator.setThreads(1);
+	vector<Layer<T>> best = layers_;
+
+	TrainingReport report;
+	report.bestLoss = validator.loss(Xval, Yval, Xval.size());
+	const size_t interval = std::max(stopping.interval, size_t(1));
+	size_t pendingEpoch = 0, stale = 0;
+	std::future<double> pending;
+
+	// scores the snapshot handed to the validator, true once training should stop
+	auto collect = [&]() {
+		const double loss = pending.get();
+		++report.checks;
+		if (loss < report.bestLoss - stopping.minDelta)
+		{
+			report.bestLoss = loss;
+			report.bestEpoch = pendingEpoch;
+			std::swap(best, validator.layers_);
+			stale = 0;
+		}
+		else
+			++stale;
+
+		return stale >= stopping.patience;
+	};
 
-	// select neurons to keep
-	vector<int> neuronsToDrop(toDrop, -1); // list of neuron indicies to drop
-	size_t i = 0;
-	while (i < neuronsToDrop.size())
+	while (report.epochs < epochs && !report.stoppedEarly)
 	{
-		int possibleIndex = rand() % layers_[layer].size_; // select random index
-		if (std::find(neuronsToDrop.begin(), neuronsToDrop.end(), possibleIndex) == neuronsToDrop.end()) // make sure the index isn't repeated
+		step();
+		if (++report.epochs % interval != 0 && report.epochs != epochs)
+			continue;
+
+		// collect the last check before handing the validator the current weights
+		if (pending.valid() && collect())
+			report.stoppedEarly = true;
+		else
 		{
-			neuronsToDrop[i] = possibleIndex;
-			++i;
+			validator.layers_ = layers_;
+			pendingEpoch = report.epochs;
+			pending = std::async(std::launch::async, [&]() { return validator.loss(Xval, Yval, Xval.size()); });
 		}
 	}
+	if (pending.valid())
+		collect(); // the last check, nothing is left to stop
+
+	layers_ = best;
+	return report;
+}
+
+////////////////////////////////////////
+// runs the first count samples of Xdata through the network across the thread
+// pool and writes their output activations row-major into outputs, all
+// buffers are local to the call so any number of threads may call this at once
+template <typename T>
+void BasicNetwork<T>::batchPredict(const valarray<ValD>& Xdata, size_t count, T* outputs) const
+{
+	const size_t inputs = layers_[0].size_, outs = layers_.back().size_;
+	const size_t shards = std::min(pool_->size(), count);
+
+	pool_->run(shards, [&](size_t t) {
+		const size_t first = t * count / shards, last = (t + 1) * count / shards;
+		const size_t block = std::min(PREDICT_BLOCK, last - first);
+
+		// shard buffers, the shard is run through in blocks of at most PREDICT_BLOCK rows
+		BatchWorker<T> worker;
+		worker.alpha.resize(layers_.size());
+		for (size_t l = 1; l != layers_.size(); ++l)
+			worker.alpha[l].resize(block * layers_[l].size_);
+		ValT Xblock(block * inputs);
+
+		for (size_t i = first; i < last; i += block)
+		{
+			const size_t rows = std::min(block, last - i);
+			for (size_t r = 0; r != rows; ++r)
+				std::copy(&Xdata[i + r][0], &Xdata[i + r][0] + inputs, &Xblock[r * inputs]);
+
+			batchForwardPropagation(&Xblock[0], rows, worker);
+			std::copy(&worker.alpha.back()[0], &worker.alpha.back()[0] + rows * outs, outputs + i * outs);
+		}
+	});
+}
+
+////////////////////////////////////////
+// returns the argmax output neuron of every sample
+template <typename T>
+vector<size_t> BasicNetwork<T>::predict(const valarray<ValD>& Xdata) const
+{
+	const size_t outs = layers_.back().size_;
+	ValT outputs(Xdata.size() * outs);
+	batchPredict(Xdata, Xdata.size(), &outputs[0]);
+
+	vector<size_t> labels(Xdata.size());
+	for (size_t i = 0; i != labels.size(); ++i)
+		labels[i] = argmax(&outputs[i * outs], outs);
+
+	return labels;
+}
+
+////////////////////////////////////////
+// returns the output layer activations of every sample
+template <typename T>
+valarray<ValD> BasicNetwork<T>::probabilities(const valarray<ValD>& Xdata) const
+{
+	const size_t outs = layers_.back().size_;
+	ValT outputs(Xdata.size() * outs);
+	batchPredict(Xdata, Xdata.size(), &outputs[0]);
+
+	valarray<ValD> probs(ValD(outs), Xdata.size());
+	for (size_t i = 0; i != probs.size(); ++i)
+		std::copy(&outputs[i * outs], &outputs[i * outs] + outs, &probs[i][0]);
+
+	return probs;
+}
+
+////////////////////////////////////////
+// tests the network and returns a decimal of correct answers / total
+template <typename T>
+double BasicNetwork<T>::test(const valarray<ValD>& Xdata, const ValD& Ydata, const size_t& epochs) const
+{
+	const size_t outs = layers_.back().size_;
+	ValT outputs(epochs * outs);
+	batchPredict(Xdata, epochs, &outputs[0]);
 
-	// changing layer
-	valarray<ValD> newWeights(ValD(layers_[layer - 1].size_), layers_[layer].size_ - toDrop);
-	ValD newBiases(layers_[layer].size_ - toDrop);
-	for (size_t j = 0, k = 0; j < layers_[layer].size_; ++j)
-		if (std::find(neuronsToDrop.begin(), neuronsToDrop.end(), j) == neuronsToDrop.end()) // if index j isnt to be dropped
+	size_t success = 0;
+	for (size_t i = 0; i != epochs; ++i)
+		if (argmax(&outputs[i * outs], outs) == Ydata[i])
+			++success;
+
+	return double(success) / double(epochs);
+}
+
+////////////////////////////////////////
+// mean cross entropy of the first count samples, the sum over every output
+// for sigmoid outputs and -log of the expected output for softmax
+template <typename T>
+double BasicNetwork<T>::loss(const valarray<ValD>& Xdata, const ValD& Ydata, const size_t& count) const
+{
+	const size_t outs = layers_.back().size_;
+	ValT outputs(count * outs);
+	batchPredict(Xdata, count, &outputs[0]);
+
+	const double tiny = 1e-12; // keeps log away from 0
+	double total = 0;
+	for (size_t i = 0; i != count; ++i)
+		for (size_t j = 0; j != outs; ++j)
 		{
-			newWeights[k] = layers_[layer].weights_[j];
-			newBiases[k] = layers_[layer].biases_[j];
-			++k;
+			const double a = outputs[i * outs + j];
+			if (j == size_t(Ydata[i]))
+				total -= std::log(a + tiny);
+			else if (output_ == SIGMOID_OUTPUT)
+				total -= std::log(1 - a + tiny);
 		}
 
-	layers_[layer].weights_ = newWeights;
-	layers_[layer].biases_ = newBiases;
-	layers_[layer].size_ = layers_[layer].size_ - toDrop;
-
-	// changing next layer
-	newWeights = valarray<ValD>(ValD(layers_[layer].size_), layers_[layer + 1].size_);
-	for (size_t j = 0; j < newWeights.size(); ++j)
-		for (size_t k = 0, p = 0; k < newWeights[j].size() + toDrop; ++k)
-			if (std::find(neuronsToDrop.begin(), neuronsToDrop.end(), k) == neuronsToDrop.end()) // if index k isnt to be dropped
-			{
-				newWeights[j][p] = layers_[layer + 1].weights_[j][k];
-				++p;
-			}
-
-	layers_[layer + 1].weights_ = newWeights;
+	return count ? total / count : 0.0;
+}
+
+////////////////////////////////////////
+// drops each neuron of layer with probability rate on every training step,
+// survivors are scaled by 1 / (1 - rate) so nothing changes at inference,
+// throws unless layer is a hidden layer and rate is in [0, 1)
+template <typename T>
+void BasicNetwork<T>::dropout(size_t layer, double rate)
+{
+	if (layer == 0 || layer >= layers_.size() - 1) // can't dropout in the input layer or output layer
+		throw std::invalid_argument("dropout needs a hidden layer, got layer " + std::to_string(layer));
+	if (!(rate >= 0.0 && rate < 1.0))
+		throw std::invalid_argument("dropout rate must be at least 0 and below 1, got " + std::to_string(rate));
+
+	keep_[layer] = 1.0 - rate;
 }
 
 ////////////////////////////////////////
 // prints out all parts of the network
-void Network::print() const
+template <typename T>
+void BasicNetwork<T>::print() const
 {
 	// output layer sizes first seperated by a space
 	cout << "LAYER SIZES: " << endl;
@@ -235,8 +786,8 @@ void Network::print() const
 	for (size_t i = 1; i < layers_.size(); ++i)
 		for (size_t j = 0; j < layers_[i].size_; ++j)
 		{
-			for (size_t k = 0; k < layers_[i].weights_[j].size(); ++k)
-				cout << layers_[i].weights_[j][k] << ' ';
+			for (size_t k = 0; k < layers_[i].stride_; ++k)
+				cout << layers_[i].row(j)[k] << ' ';
 			cout << endl;
 		}
 	cout << endl;
@@ -246,11 +797,132 @@ void Network::print() const
 	for (size_t i = 1; i < layers_.size(); ++i)
 	{
 		for (size_t j = 0; j < layers_[i].size_; ++j)
-			cout << layers_[i].biases_[j] << ' ';
+			cout << layers_[i].biases()[j] << ' ';
 		cout << endl;
 	}
 	cout << endl;
 }
 
+////////////////////////////////////////
+// copies mapped weights and biases into the layers so they can be changed
+template <typename T>
+void BasicNetwork<T>::detach()
+{
+	if (!mapping_)
+		return;
+
+	for (size_t l = 1; l != layers_.size(); ++l)
+		layers_[l].detach();
+	mapping_.reset();
+}
+
+////////////////////////////////////////
+// bytes a layer takes up in a model file, padded so the next layer stays aligned
+size_t modelLayerBytes(size_t prevLayerNeurons, size_t neurons, size_t scalarBytes)
+{
+	return ((prevLayerNeurons + 1) * neurons * scalarBytes + 7) / 8 * 8;
+}
+
+////////////////////////////////////////
+// writes the network to a binary model file, see MODEL FILE for the layout
+// the model is written next to file and then moved over it, so a model that
+// is mapped from file, this one included, never sees it change
+template <typename T>
+void BasicNetwork<T>::save(const string& file) const
+{
+	const string temp = file + ".tmp";
+	std::ofstream out(temp, std::ios::binary);
+	if (!out)
+		throw std::runtime_error("can't write " + temp);
+
+	uint32_t header[4] = { MODEL_VERSION, uint32_t(layers_.size()), uint32_t(sizeof(T)), uint32_t(output_) };
+	out.write(MODEL_MAGIC, sizeof(MODEL_MAGIC));
+	out.write(reinterpret_cast<const char*>(header), sizeof(header));
+	for (size_t l = 0; l != layers_.size(); ++l)
+	{
+		uint64_t size = layers_[l].size_;
+		out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+	}
+	out.write(reinterpret_cast<const char*>(&stepConstant_), sizeof(stepConstant_));
+	out.write(reinterpret_cast<const char*>(&lambda_), sizeof(lambda_));
+
+	const char padding[8] = {};
+	for (size_t l = 1; l != layers_.size(); ++l)
+	{
+		const size_t weights = layers_[l].size_ * layers_[l].stride_;
+		out.write(reinterpret_cast<const char*>(layers_[l].weights()), weights * sizeof(T));
+		out.write(reinterpret_cast<const char*>(layers_[l].biases()), layers_[l].size_ * sizeof(T));
+		out.write(padding, modelLayerBytes(layers_[l].stride_, layers_[l].size_, sizeof(T)) - (weights + layers_[l].size_) * sizeof(T));
+	}
+
+	out.close();
+	if (!out || !replaceFile(temp, file))
+	{
+		std::remove(temp.c_str());
+		throw std::runtime_error("can't write " + file);
+	}
+}
+
+////////////////////////////////////////
+// maps a binary model file, the layers point straight into the mapping so
+// nothing is parsed or copied, the weights are only copied once trained
+template <typename T>
+BasicNetwork<T> BasicNetwork<T>::load(const string& file)
+{
+	std::shared_ptr<MappedFile> mapping = std::make_shared<MappedFile>(file);
+	const char* data = mapping->data();
+	const size_t size = mapping->size();
+
+	// header
+	uint32_t header[4];
+	const size_t fixed = sizeof(MODEL_MAGIC) + sizeof(header);
+	if (size < fixed || memcmp(data, MODEL_MAGIC, sizeof(MODEL_MAGIC)) != 0)
+		throw std::runtime_error(file + " is not a model file");
+	memcpy(header, data + sizeof(MODEL_MAGIC), sizeof(header));
+	const size_t count = header[1];
+	if (header[0] != MODEL_VERSION)
+		throw std::runtime_error(file + " has an unsupported model version");
+	if (header[2] != sizeof(T))
+		throw std::runtime_error(file + " was saved with a different scalar type");
+	if (header[3] > SOFTMAX_OUTPUT)
+		throw std::runtime_error(file + " has an unknown output layer");
+
+	size_t offset = fixed + count * sizeof(uint64_t) + 2 * sizeof(double);
+	if (count < 2 || size < offset)
+		throw std::runtime_error(file + " is truncated");
+
+	vector<size_t> sizes(count);
+	for (size_t l = 0; l != count; ++l)
+	{
+		uint64_t layerSize;
+		memcpy(&layerSize, data + fixed + l * sizeof(uint64_t), sizeof(layerSize));
+		sizes[l] = size_t(layerSize);
+	}
+	double stepConst, lambda;
+	memcpy(&stepConst, data + fixed + count * sizeof(uint64_t), sizeof(double));
+	memcpy(&lambda, data + fixed + count * sizeof(uint64_t) + sizeof(double), sizeof(double));
+
+	// layers read their weights and biases in place
+	BasicNetwork net(vector<size_t>(1, sizes[0]), stepConst, lambda);
+	net.layers_.resize(count);
+	net.keep_.assign(count, 1.0);
+	for (size_t l = 1; l != count; ++l)
+	{
+		const size_t bytes = modelLayerBytes(sizes[l - 1], sizes[l], sizeof(T));
+		if (size < offset + bytes)
+			throw std::runtime_error(file + " is truncated");
+
+		const T* layerData = reinterpret_cast<const T*>(data + offset);
+		net.layers_[l] = Layer<T>(sizes[l - 1], sizes[l], layerData, layerData + sizes[l] * sizes[l - 1]);
+		offset += bytes;
+	}
+
+	net.mapping_ = mapping;
+	net.output_ = OutputLayer(header[3]);
+	net.workspace_ = Workspace<T>(sizes);
+	net.setThreads(1);
+	return net;
+}
+
 #endif // NETWORK_H
 
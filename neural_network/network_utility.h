@@ -4,19 +4,36 @@
 ////////////////////////////////////////////////////////////////////////////////
 //
 // FILE:        network_utility.h
-// DESCRIPTION: contains helper functions and smaller structs for Network class
+// DESCRIPTION: contains helper functions and smaller structs for Network class,
+//              everything is templated on the scalar type T (double or float)
 // AUTHOR:      Dan Fabian
 // DATE:        10/20/2019
 
+#include "kernels.h"
+#include "profiler.h"
 #include <valarray>
 #include <vector>
 #include <random>
+#include <algorithm>
 
 using std::valarray;
 using std::vector;
 
 typedef valarray<double> ValD;
 
+// block sizes for gemm, chosen so a packed block of A and B fit in L2 together
+const size_t GEMM_MC = 64;
+const size_t GEMM_KC = 256;
+const size_t GEMM_NC = 512;
+
+// most rows a single inference thread pushes through the network at once
+const size_t PREDICT_BLOCK = 256;
+
+// activation of the output layer, independent sigmoids or one softmax over
+// all outputs, both are trained against cross entropy so the output delta
+// is Y - a either way
+enum OutputLayer { SIGMOID_OUTPUT, SOFTMAX_OUTPUT };
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // LAYER
@@ -26,59 +43,242 @@ typedef valarray<double> ValD;
 //               |          W[1][0]
 //               -------------------------- neuron
 // and the weights pictured above belong under L2
+//
+// weights are stored row-major in a single contiguous block, W[j][k] lives at
+// weights_[j * stride_ + k] where stride_ is the size of the previous layer
+//
+// a layer can also read its weights and biases in place from a memory mapped
+// model file, it then only owns copies of them after detach() is called
+template <typename T>
 struct Layer {
 	// constructors
-	Layer() : size_(0) {}
+	Layer() : size_(0), stride_(0), mappedWeights_(nullptr), mappedBiases_(nullptr) {}
+	Layer(size_t prevLayerNeurons, size_t neurons, const T* weights, const T* biases) :
+		size_(neurons),
+		stride_(prevLayerNeurons),
+		mappedWeights_(weights),
+		mappedBiases_(biases) {}
 	Layer(size_t prevLayerNeurons, size_t neurons) :
-		weights_(valarray<ValD>(ValD(prevLayerNeurons), neurons)),
-		biases_(ValD(neurons)),
-		size_(neurons)
+		weights_(valarray<T>(prevLayerNeurons * neurons)),
+		biases_(valarray<T>(neurons)),
+		size_(neurons),
+		stride_(prevLayerNeurons),
+		mappedWeights_(nullptr),
+		mappedBiases_(nullptr)
 	{
-		// init seed and create distibution
+		// init seed and create distibution, drawn in double so every T starts from the same network
 		std::default_random_engine generator;
 		std::normal_distribution<double> distributionOne(0, (1.0 / sqrt(prevLayerNeurons))); // for weights
 		std::normal_distribution<double> distributionTwo(0, 1); // for biases
 
 		// init weights with normal distribution with a mean of 0 and SD of 1/sqrt(incoming weights)
 		for (size_t i = 0; i != weights_.size(); ++i)
-			for (size_t j = 0; j != weights_[i].size(); ++j)
-				weights_[i][j] = distributionOne(generator);
+			weights_[i] = T(distributionOne(generator));
 
 		// init biases
 		for (size_t i = 0; i != biases_.size(); ++i)
-			biases_[i] = distributionTwo(generator);
+			biases_[i] = T(distributionTwo(generator));
 	}
 
 	// overloaded assignment
 	Layer& operator=(const Layer& rhs)
 	{
 		size_ = rhs.size_;
+		stride_ = rhs.stride_;
 		weights_ = rhs.weights_;
 		biases_ = rhs.biases_;
+		mappedWeights_ = rhs.mappedWeights_;
+		mappedBiases_ = rhs.mappedBiases_;
 
 		return *this;
 	}
 
-	valarray<ValD> weights_;
-	ValD           biases_;
-	size_t         size_;
+	// read access, works for owned and mapped layers
+	const T* weights ()         const { return mappedWeights_ ? mappedWeights_ : &weights_[0]; }
+	const T* biases  ()         const { return mappedBiases_ ? mappedBiases_ : &biases_[0]; }
+	const T* row     (size_t j) const { return weights() + j * stride_; }
+
+	// returns a pointer to the incoming weights of neuron j, layer must be owned
+	T*       row     (size_t j)       { return &weights_[j * stride_]; }
+
+	// copies mapped weights and biases into the layer so they can be changed
+	void detach()
+	{
+		if (!mappedWeights_)
+			return;
+
+		weights_ = valarray<T>(mappedWeights_, size_ * stride_);
+		biases_ = valarray<T>(mappedBiases_, size_);
+		mappedWeights_ = mappedBiases_ = nullptr;
+	}
+
+	valarray<T> weights_; // size_ rows of stride_ weights each
+	valarray<T> biases_;
+	size_t      size_;
+	size_t      stride_;  // incoming weights per neuron, size of previous layer
+	const T*    mappedWeights_;
+	const T*    mappedBiases_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// WORKSPACE
+// notes: every buffer a single sample needs on its way through the network,
+//        sized once from the layer sizes so forward and back prop never allocate
+template <typename T>
+struct Workspace {
+	// constructors
+	Workspace() {}
+	explicit Workspace(const vector<size_t>& layerSizes) :
+		alpha(vector<valarray<T>>(layerSizes.size())),
+		delta(vector<valarray<T>>(layerSizes.size())),
+		weightGrads(vector<valarray<T>>(layerSizes.size())),
+		target(valarray<T>(layerSizes.back()))
+	{
+		for (size_t l = 0; l != layerSizes.size(); ++l)
+		{
+			alpha[l].resize(layerSizes[l]);
+			delta[l].resize(layerSizes[l]);
+			if (l != 0)
+				weightGrads[l].resize(layerSizes[l] * layerSizes[l - 1]);
+		}
+	}
+
+	vector<valarray<T>> alpha;       // alpha[l] holds the activations of layer l, alpha[0] holds the raw inputs
+	vector<valarray<T>> delta;       // delta[l] holds the deltas of layer l
+	vector<valarray<T>> weightGrads; // weightGrads[l] holds the weight gradients of layer l, row-major
+	valarray<T>         target;      // expected output layer activations
+	std::minstd_rand    generator;   // draws dropout masks
+	NETWORK_PROFILE(PhaseCounters counters;) // time spent and outputs scored since the last epoch
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// BATCH WORKER
+// notes: buffers owned by a single thread of the batch trainer, all matrices
+//        are row-major with one row per sample of the worker's shard
+template <typename T>
+struct BatchWorker {
+	vector<valarray<T>> alpha;       // alpha[l] is (rows x layer size) activations, inputs are read in place
+	vector<valarray<T>> delta;       // delta[l] is (rows x layer size) deltas
+	vector<valarray<T>> weightGrads; // weight gradients summed over the shard, same layout as Layer::weights_
+	vector<valarray<T>> biasGrads;   // bias gradients summed over the shard
+	std::minstd_rand    generator;   // draws dropout masks
+	NETWORK_PROFILE(PhaseCounters counters;) // time spent and outputs scored since the last epoch
 };
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // HELPER FUNCTIONS
 ////////////////////////////////////////
-// sigmoid function
-ValD sigmoid(const ValD& z)
+// dot product of two contiguous arrays of length n
+template <typename T>
+T dot(const T* a, const T* b, size_t n)
+{
+	return kernels<T>().dot(a, b, n);
+}
+
+////////////////////////////////////////
+// index of the largest of n values, the first one wins ties
+template <typename T>
+size_t argmax(const T* a, size_t n)
+{
+	size_t best = 0;
+	for (size_t j = 1; j < n; ++j)
+		if (a[best] < a[j])
+			best = j;
+
+	return best;
+}
+
+////////////////////////////////////////
+// y = a * x + b * y over contiguous arrays of length n
+template <typename T>
+void axpby(T a, const T* x, T b, T* y, size_t n)
+{
+	kernels<T>().axpby(a, x, b, y, n);
+}
+
+////////////////////////////////////////
+// cache blocked matrix multiply on row-major matrices:
+//     C (M x N) += alpha * op(A) (M x K) * op(B) (K x N)
+// op(X) is X or X transposed depending on transA / transB, in which case the
+// stored matrix is K x M (or N x K). blocks of op(A) and op(B) are packed into
+// contiguous buffers so the inner loop always runs unit stride over C and B,
+// the buffers only ever grow to the largest blocks a thread has needed so
+// small matrices never allocate a full block
+template <typename T>
+void gemm(bool transA, bool transB, size_t M, size_t N, size_t K,
+	T alpha, const T* A, const T* B, T* C)
+{
+	static thread_local vector<T> packA, packB;
+	packA.resize(std::max(packA.size(), std::min(GEMM_MC, M) * std::min(GEMM_KC, K)));
+	packB.resize(std::max(packB.size(), std::min(GEMM_KC, K) * std::min(GEMM_NC, N)));
+
+	for (size_t jc = 0; jc < N; jc += GEMM_NC)
+	{
+		const size_t nc = std::min(GEMM_NC, N - jc);
+		for (size_t pc = 0; pc < K; pc += GEMM_KC)
+		{
+			const size_t kc = std::min(GEMM_KC, K - pc);
+
+			// pack op(B)[pc:pc+kc][jc:jc+nc]
+			for (size_t p = 0; p != kc; ++p)
+				for (size_t j = 0; j != nc; ++j)
+					packB[p * nc + j] = transB ? B[(jc + j) * K + pc + p] : B[(pc + p) * N + jc + j];
+
+			for (size_t ic = 0; ic < M; ic += GEMM_MC)
+			{
+				const size_t mc = std::min(GEMM_MC, M - ic);
+
+				// pack alpha * op(A)[ic:ic+mc][pc:pc+kc]
+				for (size_t i = 0; i != mc; ++i)
+					for (size_t p = 0; p != kc; ++p)
+						packA[i * kc + p] = alpha * (transA ? A[(pc + p) * M + ic + i] : A[(ic + i) * K + pc + p]);
+
+				// multiply packed blocks into C
+				for (size_t i = 0; i != mc; ++i)
+				{
+					T* c = C + (ic + i) * N + jc;
+					for (size_t p = 0; p != kc; ++p)
+						axpby(packA[i * kc + p], &packB[p * nc], T(1), c, nc);
+				}
+			}
+		}
+	}
+}
+
+////////////////////////////////////////
+// inverted dropout, zeroes each of n activations with probability 1 - keep and
+// scales the rest by 1 / keep so the expected activation doesn't change
+template <typename T>
+void dropoutMask(T* alpha, size_t n, double keep, std::minstd_rand& generator)
+{
+	const std::minstd_rand::result_type threshold =
+		std::minstd_rand::min() + std::minstd_rand::result_type(keep * (std::minstd_rand::max() - std::minstd_rand::min()));
+	const T scale = T(1.0 / keep);
+	for (size_t i = 0; i != n; ++i)
+		alpha[i] = generator() < threshold ? alpha[i] * scale : T(0);
+}
+
+////////////////////////////////////////
+// sigmoid function over a contiguous array, out may alias z
+template <typename T>
+void sigmoid(const T* z, T* out, size_t n)
 {
-	return 1.0 / (1.0 + exp(-z));
+	kernels<T>().sigmoid(z, out, n);
 }
 
 ////////////////////////////////////////
-// sigmoid prime function
-ValD sigmoidPrime(const ValD& z)
+// output layer activations of rows samples with n outputs each, in place
+template <typename T>
+void activateOutputs(OutputLayer output, T* alpha, size_t rows, size_t n)
 {
-	return sigmoid(z) * (1.0 - sigmoid(z));
+	if (output == SIGMOID_OUTPUT)
+		sigmoid(alpha, alpha, rows * n);
+	else
+		for (size_t i = 0; i != rows; ++i)
+			kernels<T>().softmax(alpha + i * n, alpha + i * n, n);
 }
 
 #endif // NETWORK_UTILITY_H
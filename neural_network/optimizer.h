@@ -0,0 +1,169 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// FILE:        optimizer.h
+// DESCRIPTION: contains the optimizers a Network trains with, plain stochastic
+//              gradient descent, momentum and adam
+// AUTHOR:      Dan Fabian
+// DATE:        10/20/2019
+
+#include "network_utility.h"
+#include <cmath>
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// OPTIMIZER
+// notes: the network hands its parameters over in slots, slot 2l holds the
+//        weights of layer l and slot 2l + 1 its biases, every slot keeps its
+//        state in contiguous buffers the same size as the slot
+//        grads are summed over a batch and point in the direction that
+//        improves the network, so every update adds them:
+//        params = (1 + regularization) * params + rate * scale * grads
+//        for plain sgd, which is the rule the network has always used
+template <typename T>
+class Optimizer {
+public:
+	virtual ~Optimizer() {}
+
+	// methods
+	virtual Optimizer* clone  () const = 0;                                // copy with the same settings and state
+	virtual void       resize (const vector<size_t>&) {}                   // sizes the state buffers, state is kept if nothing changed
+	virtual void       begin  () {}                                        // called once before the updates of every training step
+	virtual void       update (size_t slot, T* params, const T* grads, size_t n,
+	                           double rate, double scale, double regularization) = 0; // adjusts the n params of slot
+};
+
+////////////////////////////////////////
+// sizes state to slotSizes and zeroes it, returns false if it already fit
+template <typename T>
+bool resizeState(vector<valarray<T>>& state, const vector<size_t>& slotSizes)
+{
+	bool fits = state.size() == slotSizes.size();
+	for (size_t s = 0; fits && s != slotSizes.size(); ++s)
+		fits = state[s].size() == slotSizes[s];
+	if (fits)
+		return false;
+
+	state.assign(slotSizes.size(), valarray<T>());
+	for (size_t s = 0; s != slotSizes.size(); ++s)
+		state[s].resize(slotSizes[s], T(0));
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// SGD
+// notes: no state, one axpby per slot
+template <typename T>
+class Sgd : public Optimizer<T> {
+public:
+	// methods
+	Optimizer<T>* clone  () const { return new Sgd(*this); }
+	void          update (size_t slot, T* params, const T* grads, size_t n,
+	                      double rate, double scale, double regularization);
+};
+
+////////////////////////////////////////
+// params = (1 + regularization) * params + rate * scale * grads
+template <typename T>
+void Sgd<T>::update(size_t, T* params, const T* grads, size_t n, double rate, double scale, double regularization)
+{
+	axpby(T(rate * scale), grads, 1 + T(regularization), params, n);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// MOMENTUM
+// notes: velocity = momentum * velocity + rate * scale * grads
+//        params   = (1 + regularization) * params + velocity
+template <typename T>
+class Momentum : public Optimizer<T> {
+public:
+	// constructor
+	explicit Momentum(double momentum = 0.9) : momentum_(momentum) {}
+
+	// methods
+	Optimizer<T>* clone  () const { return new Momentum(*this); }
+	void          resize (const vector<size_t>& slotSizes) { resizeState(velocity_, slotSizes); }
+	void          update (size_t slot, T* params, const T* grads, size_t n,
+	                      double rate, double scale, double regularization);
+
+private:
+	vector<valarray<T>> velocity_;
+	double              momentum_;
+};
+
+////////////////////////////////////////
+// one fused pass over the slot updates velocity and params together
+template <typename T>
+void Momentum<T>::update(size_t slot, T* params, const T* grads, size_t n, double rate, double scale, double regularization)
+{
+	kernels<T>().momentum(T(rate * scale), grads, T(momentum_), &velocity_[slot][0], 1 + T(regularization), params, n);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// ADAM
+// notes: m and v are running averages of the gradient and its square, the
+//        bias corrections 1 - beta^t are folded into the rate and epsilon
+//        once per step so the per element work is a single fused pass:
+//        params = (1 + regularization) * params
+//                 + rate * sqrt(1 - beta2^t) / (1 - beta1^t) * m / (sqrt(v) + epsilon * sqrt(1 - beta2^t))
+template <typename T>
+class Adam : public Optimizer<T> {
+public:
+	// constructor
+	explicit Adam(double beta1 = 0.9, double beta2 = 0.999, double epsilon = 1e-8) :
+		beta1_(beta1), beta2_(beta2), epsilon_(epsilon), steps_(0) {}
+
+	// methods
+	Optimizer<T>* clone  () const { return new Adam(*this); }
+	void          resize (const vector<size_t>& slotSizes);
+	void          begin  () { ++steps_; }
+	void          update (size_t slot, T* params, const T* grads, size_t n,
+	                      double rate, double scale, double regularization);
+
+private:
+	vector<valarray<T>> m_;
+	vector<valarray<T>> v_;
+	double              beta1_;
+	double              beta2_;
+	double              epsilon_;
+	size_t              steps_;
+};
+
+////////////////////////////////////////
+// sizes the averages, starting over resets the bias correction too
+template <typename T>
+void Adam<T>::resize(const vector<size_t>& slotSizes)
+{
+	if (resizeState(m_, slotSizes))
+	{
+		resizeState(v_, slotSizes);
+		steps_ = 0;
+	}
+}
+
+////////////////////////////////////////
+// one fused pass over the slot updates both averages and params together
+template <typename T>
+void Adam<T>::update(size_t slot, T* params, const T* grads, size_t n, double rate, double scale, double regularization)
+{
+	const double correction1 = 1 - std::pow(beta1_, double(steps_));
+	const double correction2 = std::sqrt(1 - std::pow(beta2_, double(steps_)));
+
+	AdamStep<T> step;
+	step.beta1 = T(beta1_);
+	step.mScale = T((1 - beta1_) * scale);
+	step.beta2 = T(beta2_);
+	step.vScale = T((1 - beta2_) * scale * scale);
+	step.rate = T(rate * correction2 / correction1);
+	step.epsilon = T(epsilon_ * correction2);
+	step.decay = 1 + T(regularization);
+
+	kernels<T>().adam(step, grads, &m_[slot][0], &v_[slot][0], params, n);
+}
+
+#endif // OPTIMIZER_H
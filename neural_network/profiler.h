@@ -0,0 +1,307 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// FILE:        profiler.h
+// DESCRIPTION: contains scoped phase timers, counters and the per epoch
+//              training telemetry of Network, all of it only exists when
+//              NETWORK_PROFILING is defined before including network.h
+// AUTHOR:      Dan Fabian
+// DATE:        10/20/2019
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// SWITCH
+// notes: without NETWORK_PROFILING both macros expand to nothing, so the
+//        timers, counters and telemetry members aren't even compiled
+//        PROFILE_SCOPE(counters, phase) times the rest of the scope into counters
+//        NETWORK_PROFILE(statement)     keeps statement only when profiling
+#ifdef NETWORK_PROFILING
+#define PROFILE_JOIN(a, b) a##b
+#define PROFILE_NAME(line) PROFILE_JOIN(profileTimer, line)
+#define PROFILE_SCOPE(counters, phase) ScopedTimer PROFILE_NAME(__LINE__)(counters, phase)
+#define NETWORK_PROFILE(statement) statement
+#else
+#define PROFILE_SCOPE(counters, phase)
+#define NETWORK_PROFILE(statement)
+#endif
+
+#ifdef NETWORK_PROFILING
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// ALLOCATION COUNTERS
+// notes: every global operator new and delete is replaced to count every heap
+//        allocation the process makes, from any thread, the other forms all
+//        forward to the nothrow new and the plain delete so one malloc and one
+//        free pair up no matter which form a pointer went through
+//        the plain delete is kept out of line, inlined into a caller gcc would
+//        see free called on a pointer from operator new and warn about it
+#if defined(__GNUC__)
+#define PROFILE_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define PROFILE_NOINLINE __declspec(noinline)
+#else
+#define PROFILE_NOINLINE
+#endif
+
+std::atomic<size_t> allocationCount(0);
+std::atomic<size_t> allocationBytes(0);
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	allocationBytes.fetch_add(size, std::memory_order_relaxed);
+	return std::malloc(size ? size : 1);
+}
+
+void* operator new(size_t size)
+{
+	if (void* memory = operator new(size, std::nothrow))
+		return memory;
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return operator new(size, std::nothrow); }
+
+PROFILE_NOINLINE void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete  (void* memory, size_t) noexcept { operator delete(memory); }
+void operator delete  (void* memory, const std::nothrow_t&) noexcept { operator delete(memory); }
+void operator delete[](void* memory) noexcept { operator delete(memory); }
+void operator delete[](void* memory, size_t) noexcept { operator delete(memory); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { operator delete(memory); }
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// PHASE COUNTERS
+// notes: seconds are summed over every thread that worked on a phase, so with
+//        several training threads they add up to more than the wall time
+enum Phase { PHASE_FORWARD, PHASE_BACKPROP, PHASE_UPDATE, PHASE_COUNT };
+
+const char* const PHASE_NAMES[PHASE_COUNT] = { "forward", "backprop", "update" };
+
+struct PhaseCounters {
+	PhaseCounters() { clear(); }
+	void clear();
+	void add(const PhaseCounters& other);
+
+	double seconds[PHASE_COUNT];
+	size_t samples;
+	size_t correct; // samples whose largest output was the expected one
+	double loss;    // cross entropy summed over samples
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// SCOPED TIMER
+// notes: adds the time between construction and destruction to one phase
+class ScopedTimer {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	ScopedTimer(PhaseCounters& counters, Phase phase) : counters_(counters), phase_(phase), start_(Clock::now()) {}
+	~ScopedTimer() { counters_.seconds[phase_] += std::chrono::duration<double>(Clock::now() - start_).count(); }
+
+	ScopedTimer(const ScopedTimer&) = delete;
+	ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+	PhaseCounters&    counters_;
+	Phase             phase_;
+	Clock::time_point start_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// TELEMETRY
+// notes: one row is recorded every interval training epochs, where an epoch
+//        is one call of the update rule the way BasicNetwork::train counts them
+struct TelemetryRow {
+	size_t epoch;              // last epoch the row covers
+	size_t samples;
+	double seconds;            // wall time
+	double samplesPerSecond;
+	double phaseSeconds[PHASE_COUNT];
+	size_t allocations;
+	size_t allocatedBytes;
+	double loss;               // mean cross entropy per sample
+	double accuracy;           // decimal of training samples answered correctly
+};
+
+class Telemetry {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	// constructor
+	Telemetry() : interval_(1), epoch_(0) { restart(); }
+
+	// methods
+	void           setInterval (size_t epochs) { interval_ = epochs ? epochs : 1; }
+	PhaseCounters& counters    () { return current_; }               // counters of the running interval
+	void           endEpoch    ();                                   // records a row once interval epochs have passed
+	void           clear       () { rows_.clear(); epoch_ = 0; restart(); }
+	void           writeCsv    (const std::string& file) const;
+	void           writeJson   (const std::string& file) const;
+
+	const std::vector<TelemetryRow>& rows () const { return rows_; }
+
+private:
+	void restart (); // starts a new interval
+
+	std::vector<TelemetryRow> rows_;
+	PhaseCounters             current_;
+	size_t                    interval_;
+	size_t                    epoch_;
+	size_t                    intervalStart_; // first epoch of the running interval
+	Clock::time_point         start_;
+	size_t                    allocations_;   // allocation counters when the interval started
+	size_t                    allocatedBytes_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// PHASE COUNTERS functions
+////////////////////////////////////////
+// zeroes every counter
+void PhaseCounters::clear()
+{
+	for (size_t p = 0; p != PHASE_COUNT; ++p)
+		seconds[p] = 0.0;
+	samples = correct = 0;
+	loss = 0.0;
+}
+
+////////////////////////////////////////
+// adds every counter of other
+void PhaseCounters::add(const PhaseCounters& other)
+{
+	for (size_t p = 0; p != PHASE_COUNT; ++p)
+		seconds[p] += other.seconds[p];
+	samples += other.samples;
+	correct += other.correct;
+	loss += other.loss;
+}
+
+////////////////////////////////////////
+// scores rows output activations against their one hot expected outputs,
+// adds the cross entropy and the number of correct answers to counters
+// softmax outputs are one distribution, sigmoid outputs each their own
+template <typename T>
+void recordOutputs(const T* alpha, const T* Y, size_t rows, size_t outputs, bool softmax, PhaseCounters& counters)
+{
+	const double tiny = 1e-12; // keeps log away from 0
+	for (size_t i = 0; i != rows; ++i)
+	{
+		const T* a = alpha + i * outputs;
+		const T* y = Y + i * outputs;
+		size_t guess = 0, answer = 0;
+		for (size_t j = 0; j != outputs; ++j)
+		{
+			counters.loss -= y[j] * std::log(a[j] + tiny);
+			if (!softmax)
+				counters.loss -= (1 - y[j]) * std::log(1 - a[j] + tiny);
+			if (a[j] > a[guess]) guess = j;
+			if (y[j] > y[answer]) answer = j;
+		}
+		if (guess == answer)
+			++counters.correct;
+	}
+	counters.samples += rows;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// TELEMETRY functions
+////////////////////////////////////////
+// starts a new interval
+void Telemetry::restart()
+{
+	current_.clear();
+	intervalStart_ = epoch_ + 1;
+	start_ = Clock::now();
+	allocations_ = allocationCount.load(std::memory_order_relaxed);
+	allocatedBytes_ = allocationBytes.load(std::memory_order_relaxed);
+}
+
+////////////////////////////////////////
+// counts an epoch and records a row once interval epochs have passed
+void Telemetry::endEpoch()
+{
+	if (++epoch_ - intervalStart_ + 1 < interval_)
+		return;
+
+	TelemetryRow row;
+	row.epoch = epoch_;
+	row.samples = current_.samples;
+	row.seconds = std::chrono::duration<double>(Clock::now() - start_).count();
+	row.samplesPerSecond = row.seconds > 0.0 ? row.samples / row.seconds : 0.0;
+	for (size_t p = 0; p != PHASE_COUNT; ++p)
+		row.phaseSeconds[p] = current_.seconds[p];
+	row.allocations = allocationCount.load(std::memory_order_relaxed) - allocations_;
+	row.allocatedBytes = allocationBytes.load(std::memory_order_relaxed) - allocatedBytes_;
+	row.loss = row.samples ? current_.loss / row.samples : 0.0;
+	row.accuracy = row.samples ? double(current_.correct) / row.samples : 0.0;
+	rows_.push_back(row);
+
+	restart();
+}
+
+////////////////////////////////////////
+// writes every row as csv with a header line
+void Telemetry::writeCsv(const std::string& file) const
+{
+	std::ofstream out(file);
+	if (!out)
+		throw std::runtime_error("can't write " + file);
+
+	out << "epoch,samples,seconds,samples_per_second";
+	for (size_t p = 0; p != PHASE_COUNT; ++p)
+		out << ',' << PHASE_NAMES[p] << "_seconds";
+	out << ",allocations,allocated_bytes,loss,accuracy\n";
+
+	for (const TelemetryRow& row : rows_)
+	{
+		out << row.epoch << ',' << row.samples << ',' << row.seconds << ',' << row.samplesPerSecond;
+		for (size_t p = 0; p != PHASE_COUNT; ++p)
+			out << ',' << row.phaseSeconds[p];
+		out << ',' << row.allocations << ',' << row.allocatedBytes << ',' << row.loss << ',' << row.accuracy << '\n';
+	}
+}
+
+////////////////////////////////////////
+// writes every row as a json array of objects
+void Telemetry::writeJson(const std::string& file) const
+{
+	std::ofstream out(file);
+	if (!out)
+		throw std::runtime_error("can't write " + file);
+
+	out << "[\n";
+	for (size_t r = 0; r != rows_.size(); ++r)
+	{
+		const TelemetryRow& row = rows_[r];
+		out << "  { \"epoch\": " << row.epoch << ", \"samples\": " << row.samples
+			<< ", \"seconds\": " << row.seconds << ", \"samples_per_second\": " << row.samplesPerSecond;
+		for (size_t p = 0; p != PHASE_COUNT; ++p)
+			out << ", \"" << PHASE_NAMES[p] << "_seconds\": " << row.phaseSeconds[p];
+		out << ", \"allocations\": " << row.allocations << ", \"allocated_bytes\": " << row.allocatedBytes
+			<< ", \"loss\": " << row.loss << ", \"accuracy\": " << row.accuracy << " }"
+			<< (r + 1 != rows_.size() ? ",\n" : "\n");
+	}
+	out << "]\n";
+}
+
+#endif // NETWORK_PROFILING
+
+#endif // PROFILER_H
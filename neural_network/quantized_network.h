@@ -0,0 +1,251 @@
+#ifndef QUANTIZED_NETWORK_H
+#define QUANTIZED_NETWORK_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// FILE:        quantized_network.h
+// DESCRIPTION: contains an int8 quantized copy of a trained network for
+//              inference only, and a report comparing it to the original
+// AUTHOR:      Dan Fabian
+// DATE:        10/20/2019
+
+#include "network.h"
+#include <cstdint>
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// QUANTIZED LAYER
+// notes: weights are quantized symmetrically with one scale per layer,
+//        W[j][k] ~= weights_[j * depth_ + k] * scale_
+//        every row is zero padded from stride_ to depth_, a multiple of
+//        INT8_DEPTH, so the int8 kernels never have a tail
+struct QuantizedLayer {
+	vector<int8_t> weights_;
+	vector<float>  biases_;
+	float          scale_;
+	size_t         size_;
+	size_t         stride_;
+	size_t         depth_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// QUANTIZED NETWORK
+// notes: activations are quantized per sample before every layer, each layer
+//        is then one exact int8 matrix product over a block of samples scaled
+//        back to float, so the only error is the rounding of the weights and
+//        activations to 8 bits
+//        samples are run through in blocks of PREDICT_BLOCK like the float
+//        networks, so the weights of a layer are read once per block
+class QuantizedNetwork {
+public:
+	// constructor
+	template <typename T>
+	explicit QuantizedNetwork(const BasicNetwork<T>& net);
+
+	// methods
+	vector<size_t> predict       (const valarray<ValD>& Xdata) const;                        // returns the argmax output neuron of every sample
+	valarray<ValD> probabilities (const valarray<ValD>& Xdata) const;                        // returns the output layer activations of every sample
+	double         test          (const valarray<ValD>& Xdata, const ValD& Ydata,
+	                              const size_t& epochs) const;                               // returns a decimal of correct answers / total
+	void           setThreads    (size_t threads) { pool_ = std::make_shared<ThreadPool>(threads ? threads : 1); }
+	size_t         bytes         () const;                                                   // memory taken by weights, biases and scales
+
+private:
+	// helper functions
+	void batchPredict (const valarray<ValD>& Xdata, size_t count, float* outputs) const; // output activations of the first count samples, row-major
+
+	vector<QuantizedLayer>      layers_;
+	OutputLayer                 output_;
+	std::shared_ptr<ThreadPool> pool_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// QUANTIZED NETWORK functions
+////////////////////////////////////////
+// quantizes every layer of net, scale = largest absolute weight / 127
+template <typename T>
+QuantizedNetwork::QuantizedNetwork(const BasicNetwork<T>& net) :
+	layers_(net.layers().size()),
+	output_(net.output()),
+	pool_(std::make_shared<ThreadPool>(1))
+{
+	const vector<Layer<T>>& layers = net.layers();
+	layers_[0].size_ = layers[0].size_;
+	layers_[0].stride_ = 0;
+	layers_[0].depth_ = 0;
+	layers_[0].scale_ = 1.0f;
+	for (size_t l = 1; l != layers.size(); ++l)
+	{
+		const size_t weights = layers[l].size_ * layers[l].stride_;
+		QuantizedLayer& layer = layers_[l];
+		layer.size_ = layers[l].size_;
+		layer.stride_ = layers[l].stride_;
+		layer.depth_ = (layer.stride_ + INT8_DEPTH - 1) / INT8_DEPTH * INT8_DEPTH;
+
+		float maxWeight = 0.0f;
+		for (size_t i = 0; i != weights; ++i)
+			maxWeight = std::max(maxWeight, float(std::fabs(layers[l].weights()[i])));
+		layer.scale_ = maxWeight > 0.0f ? maxWeight / 127.0f : 1.0f;
+
+		layer.weights_.assign(layer.size_ * layer.depth_, 0);
+		for (size_t j = 0; j != layer.size_; ++j)
+			for (size_t k = 0; k != layer.stride_; ++k)
+				layer.weights_[j * layer.depth_ + k] = int8_t(std::lround(layers[l].row(j)[k] / layer.scale_));
+
+		layer.biases_.assign(layers[l].biases(), layers[l].biases() + layer.size_);
+	}
+}
+
+////////////////////////////////////////
+// runs the first count samples through the network across the thread pool,
+// buffers are local to the call so any number of threads may call this at once
+void QuantizedNetwork::batchPredict(const valarray<ValD>& Xdata, size_t count, float* outputs) const
+{
+	size_t widest = 0, deepest = 0;
+	for (size_t l = 0; l != layers_.size(); ++l)
+	{
+		widest = std::max(widest, layers_[l].size_);
+		deepest = std::max(deepest, layers_[l].depth_);
+	}
+
+	const size_t inputs = layers_[0].size_, outs = layers_.back().size_;
+	const size_t shards = std::min(pool_->size(), count);
+	pool_->run(shards, [&](size_t t) {
+		const size_t first = t * count / shards, last = (t + 1) * count / shards;
+		const size_t block = std::min(PREDICT_BLOCK, last - first);
+		const size_t padded = (block + INT8_ROWS - 1) / INT8_ROWS * INT8_ROWS;
+
+		// shard buffers, rows past the block stay zero for the int8 kernel
+		vector<float>   alpha(block * widest);
+		vector<float>   scales(block);
+		vector<int16_t> quantized(padded * deepest, 0);
+		vector<int32_t> sums(padded * widest);
+
+		for (size_t i = first; i < last; i += block)
+		{
+			const size_t rows = std::min(block, last - i);
+			const size_t kernelRows = (rows + INT8_ROWS - 1) / INT8_ROWS * INT8_ROWS;
+			for (size_t r = 0; r != rows; ++r)
+				std::copy(&Xdata[i + r][0], &Xdata[i + r][0] + inputs, &alpha[r * inputs]);
+
+			for (size_t l = 1; l != layers_.size(); ++l)
+			{
+				const QuantizedLayer& layer = layers_[l];
+
+				// quantize the incoming activations of every sample with their own scale
+				const Int8Kernels& int8 = int8Kernels();
+				for (size_t r = 0; r != rows; ++r)
+					scales[r] = int8.quantize(&alpha[r * layer.stride_], &quantized[r * layer.depth_], layer.stride_, layer.depth_);
+				std::fill(&quantized[0] + rows * layer.depth_, &quantized[0] + kernelRows * layer.depth_, int16_t(0));
+
+				// Z = (int8 A * W^T) * weight scale * activation scale + biases
+				int8.gemm(&quantized[0], &layer.weights_[0], kernelRows, layer.size_, layer.depth_, &sums[0]);
+				for (size_t r = 0; r != rows; ++r)
+					int8.dequantize(&sums[r * layer.size_], layer.scale_ * scales[r], &layer.biases_[0],
+						&alpha[r * layer.size_], layer.size_);
+
+				if (l == layers_.size() - 1)
+					activateOutputs(output_, &alpha[0], rows, layer.size_);
+				else
+					sigmoid(&alpha[0], &alpha[0], rows * layer.size_);
+			}
+
+			std::copy(alpha.begin(), alpha.begin() + rows * outs, outputs + i * outs);
+		}
+	});
+}
+
+////////////////////////////////////////
+// returns the argmax output neuron of every sample
+vector<size_t> QuantizedNetwork::predict(const valarray<ValD>& Xdata) const
+{
+	const size_t outs = layers_.back().size_;
+	vector<float> outputs(Xdata.size() * outs);
+	batchPredict(Xdata, Xdata.size(), outputs.data());
+
+	vector<size_t> labels(Xdata.size());
+	for (size_t i = 0; i != labels.size(); ++i)
+		labels[i] = argmax(&outputs[i * outs], outs);
+
+	return labels;
+}
+
+////////////////////////////////////////
+// returns the output layer activations of every sample
+valarray<ValD> QuantizedNetwork::probabilities(const valarray<ValD>& Xdata) const
+{
+	const size_t outs = layers_.back().size_;
+	vector<float> outputs(Xdata.size() * outs);
+	batchPredict(Xdata, Xdata.size(), outputs.data());
+
+	valarray<ValD> probs(ValD(outs), Xdata.size());
+	for (size_t i = 0; i != probs.size(); ++i)
+		std::copy(&outputs[i * outs], &outputs[i * outs] + outs, &probs[i][0]);
+
+	return probs;
+}
+
+////////////////////////////////////////
+// tests the network and returns a decimal of correct answers / total
+double QuantizedNetwork::test(const valarray<ValD>& Xdata, const ValD& Ydata, const size_t& epochs) const
+{
+	const size_t outs = layers_.back().size_;
+	vector<float> outputs(epochs * outs);
+	batchPredict(Xdata, epochs, outputs.data());
+
+	size_t success = 0;
+	for (size_t i = 0; i != epochs; ++i)
+		if (argmax(&outputs[i * outs], outs) == Ydata[i])
+			++success;
+
+	return double(success) / double(epochs);
+}
+
+////////////////////////////////////////
+// memory taken by weights, biases and scales
+size_t QuantizedNetwork::bytes() const
+{
+	size_t total = 0;
+	for (size_t l = 1; l != layers_.size(); ++l)
+		total += layers_[l].weights_.size() * sizeof(int8_t) + layers_[l].biases_.size() * sizeof(float) + sizeof(float);
+
+	return total;
+}
+
+////////////////////////////////////////
+// prints accuracy, agreement and output error of quant against the network it
+// was made from over the first count samples
+template <typename T>
+void quantizationReport(const BasicNetwork<T>& net, const QuantizedNetwork& quant,
+	const valarray<ValD>& Xdata, const ValD& Ydata, size_t count)
+{
+	valarray<ValD> X(Xdata[std::slice(0, count, 1)]);
+	valarray<ValD> netProbs = net.probabilities(X), quantProbs = quant.probabilities(X);
+
+	size_t agree = 0;
+	double maxError = 0.0, totalError = 0.0;
+	for (size_t i = 0; i != count; ++i)
+	{
+		if (argmax(&netProbs[i][0], netProbs[i].size()) == argmax(&quantProbs[i][0], quantProbs[i].size()))
+			++agree;
+
+		ValD error = abs(netProbs[i] - quantProbs[i]);
+		maxError = std::max(maxError, error.max());
+		totalError += error.sum() / error.size();
+	}
+
+	size_t netBytes = 0;
+	for (size_t l = 1; l != net.layers().size(); ++l)
+		netBytes += (net.layers()[l].stride_ + 1) * net.layers()[l].size_ * sizeof(T);
+
+	cout << "QUANTIZATION REPORT: " << endl
+		<< "accuracy " << sizeof(T) * 8 << "-bit: " << net.test(Xdata, Ydata, count) * 100.0 << '%' << endl
+		<< "accuracy int8:   " << quant.test(Xdata, Ydata, count) * 100.0 << '%' << endl
+		<< "same answer:     " << double(agree) / double(count) * 100.0 << '%' << endl
+		<< "output error:    " << totalError / count << " mean, " << maxError << " max" << endl
+		<< "model size:      " << netBytes << " bytes -> " << quant.bytes() << " bytes" << endl << endl;
+}
+
+#endif // QUANTIZED_NETWORK_H
@@ -0,0 +1,328 @@
+#ifndef RUN_CONFIG_H
+#define RUN_CONFIG_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// FILE:        run_config.h
+// DESCRIPTION: contains the runtime parameters of one training run, read from
+//              config files and the command line, and the expansion of value
+//              lists into hyperparameter sweeps
+// AUTHOR:      Dan Fabian
+// DATE:        10/20/2019
+
+#include "config.h"
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+using std::pair;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// SETTINGS
+// notes: settings are key = value pairs in the order they were given, a later
+//        pair overrides an earlier one with the same key
+//        config files hold one pair per line and # starts a comment,
+//        the command line takes --key=value, --config file reads a file
+//        a value may list options separated by | to sweep over them, e.g.
+//        step = 0.05|0.1|0.5
+//        hidden = 8|16,16
+typedef vector<pair<string, string>> Settings;
+
+// keys that control the sweep itself rather than a single run
+const string SWEEP_KEYS[] = { "sweep", "trials", "sweep_seed", "jobs" };
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// RUN CONFIG
+// notes: every parameter of a single training run, defaults come from config.h
+struct RunConfig {
+	size_t         inputs = INPUTS;
+	size_t         outputs = OUTPUTS;
+	vector<size_t> hidden;                 // sizes of the hidden layers, none by default
+	double         step = STEP_CONSTANT;
+	double         lambda = LAMBDA;
+	size_t         epochs = TRAINING_EPOCHS;
+	size_t         batchSize = BATCH_SIZE;
+	size_t         threads = 1;            // threads per run, a sweep already runs one config per core
+	size_t         trainSize = TRAIN_DATA_SIZE;
+	size_t         testSize = TEST_DATA_SIZE;
+	string         optimizer = "sgd";      // sgd, momentum or adam
+	bool           softmax = SOFTMAX_OUTPUTS; // softmax output layer instead of sigmoids
+	double         dropout = 0.0;          // dropout rate of every hidden layer
+	unsigned       seed = 1;               // seeds the generated training and test data
+
+	vector<size_t> layerSizes () const;    // inputs, hidden layers and outputs
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// RUN CONFIG functions
+////////////////////////////////////////
+// inputs, hidden layers and outputs
+vector<size_t> RunConfig::layerSizes() const
+{
+	vector<size_t> sizes(1, inputs);
+	sizes.insert(sizes.end(), hidden.begin(), hidden.end());
+	sizes.push_back(outputs);
+
+	return sizes;
+}
+
+////////////////////////////////////////
+// strips spaces and tabs from both ends of text
+string trim(const string& text)
+{
+	const size_t first = text.find_first_not_of(" \t\r\n");
+	if (first == string::npos)
+		return "";
+
+	return text.substr(first, text.find_last_not_of(" \t\r\n") - first + 1);
+}
+
+////////////////////////////////////////
+// splits text at every separator, pieces are trimmed
+vector<string> split(const string& text, char separator)
+{
+	vector<string> pieces;
+	std::istringstream in(text);
+	string piece;
+	while (std::getline(in, piece, separator))
+		pieces.push_back(trim(piece));
+	if (!text.empty() && text.back() == separator)
+		pieces.push_back("");
+
+	return pieces;
+}
+
+////////////////////////////////////////
+// parses a whole non-negative number or throws
+size_t parseSize(const string& key, const string& value)
+{
+	char* end = nullptr;
+	unsigned long long number = std::strtoull(value.c_str(), &end, 10);
+	if (value.empty() || value[0] == '-' || *end != '\0')
+		throw std::invalid_argument(key + " expects a whole number, got '" + value + "'");
+
+	return size_t(number);
+}
+
+////////////////////////////////////////
+// parses a decimal number or throws
+double parseDouble(const string& key, const string& value)
+{
+	char* end = nullptr;
+	double number = std::strtod(value.c_str(), &end);
+	if (value.empty() || *end != '\0')
+		throw std::invalid_argument(key + " expects a number, got '" + value + "'");
+
+	return number;
+}
+
+////////////////////////////////////////
+// sets one parameter of config, throws on unknown keys or bad values
+void setOption(RunConfig& config, const string& key, const string& value)
+{
+	if (key == "inputs")          config.inputs = parseSize(key, value);
+	else if (key == "outputs")    config.outputs = parseSize(key, value);
+	else if (key == "step")       config.step = parseDouble(key, value);
+	else if (key == "lambda")     config.lambda = parseDouble(key, value);
+	else if (key == "epochs")     config.epochs = parseSize(key, value);
+	else if (key == "batch")      config.batchSize = parseSize(key, value);
+	else if (key == "threads")    config.threads = parseSize(key, value);
+	else if (key == "train_size") config.trainSize = parseSize(key, value);
+	else if (key == "test_size")  config.testSize = parseSize(key, value);
+	else if (key == "dropout")
+	{
+		config.dropout = parseDouble(key, value);
+		if (!(config.dropout >= 0.0 && config.dropout < 1.0))
+			throw std::invalid_argument("dropout must be at least 0 and below 1, got '" + value + "'");
+	}
+	else if (key == "seed")       config.seed = unsigned(parseSize(key, value));
+	else if (key == "hidden")
+	{
+		config.hidden.clear();
+		if (value != "none" && !value.empty())
+			for (const string& size : split(value, ','))
+			{
+				config.hidden.push_back(parseSize(key, size));
+				if (config.hidden.back() == 0)
+					throw std::invalid_argument("hidden layers need at least one neuron, got '" + value + "'");
+			}
+	}
+	else if (key == "output")
+	{
+		if (value != "sigmoid" && value != "softmax")
+			throw std::invalid_argument("output must be sigmoid or softmax, got '" + value + "'");
+		config.softmax = value == "softmax";
+	}
+	else if (key == "optimizer")
+	{
+		if (value != "sgd" && value != "momentum" && value != "adam")
+			throw std::invalid_argument("optimizer must be sgd, momentum or adam, got '" + value + "'");
+		config.optimizer = value;
+	}
+	else
+		throw std::invalid_argument("unknown setting '" + key + "'");
+
+	if (config.inputs == 0 || config.outputs == 0 || config.trainSize == 0 || config.testSize == 0)
+		throw std::invalid_argument(key + " must be greater than 0");
+}
+
+////////////////////////////////////////
+// adds a key = value pair to settings, replacing an earlier one with the same key
+void addSetting(Settings& settings, const string& key, const string& value)
+{
+	for (size_t i = 0; i != settings.size(); ++i)
+		if (settings[i].first == key)
+		{
+			settings[i].second = value;
+			return;
+		}
+
+	settings.push_back(std::make_pair(key, value));
+}
+
+////////////////////////////////////////
+// reads key = value lines from a config file into settings
+void readSettings(const string& file, Settings& settings)
+{
+	std::ifstream in(file);
+	if (!in)
+		throw std::runtime_error("can't open " + file);
+
+	string line;
+	for (size_t number = 1; std::getline(in, line); ++number)
+	{
+		line = trim(line.substr(0, line.find('#')));
+		if (line.empty())
+			continue;
+
+		const size_t equals = line.find('=');
+		if (equals == string::npos)
+			throw std::invalid_argument(file + ":" + std::to_string(number) + " is not a key = value line");
+		addSetting(settings, trim(line.substr(0, equals)), trim(line.substr(equals + 1)));
+	}
+}
+
+////////////////////////////////////////
+// reads --key=value arguments into settings, --config file reads a whole file
+// in place so later arguments still override it
+Settings parseArguments(int argc, char* argv[])
+{
+	Settings settings;
+	for (int i = 1; i < argc; ++i)
+	{
+		string argument = argv[i];
+		if (argument.compare(0, 2, "--") == 0)
+			argument = argument.substr(2);
+
+		const size_t equals = argument.find('=');
+		const string key = argument.substr(0, equals);
+		if (key == "config")
+		{
+			if (equals != string::npos)
+				readSettings(argument.substr(equals + 1), settings);
+			else if (i + 1 < argc)
+				readSettings(argv[++i], settings);
+			else
+				throw std::invalid_argument("--config expects a file");
+		}
+		else if (equals == string::npos)
+			throw std::invalid_argument("expected --key=value, got '" + string(argv[i]) + "'");
+		else
+			addSetting(settings, key, argument.substr(equals + 1));
+	}
+
+	return settings;
+}
+
+////////////////////////////////////////
+// returns the value of key in settings, or fallback if it isn't there
+string findSetting(const Settings& settings, const string& key, const string& fallback)
+{
+	for (size_t i = 0; i != settings.size(); ++i)
+		if (settings[i].first == key)
+			return settings[i].second;
+
+	return fallback;
+}
+
+////////////////////////////////////////
+// true if key controls the sweep rather than a single run
+bool isSweepKey(const string& key)
+{
+	for (const string& sweepKey : SWEEP_KEYS)
+		if (key == sweepKey)
+			return true;
+
+	return false;
+}
+
+////////////////////////////////////////
+// expands the | separated options of settings into run configs, every
+// combination for a grid sweep or trials random combinations otherwise
+vector<RunConfig> expandSweep(const Settings& settings)
+{
+	// options of every run setting
+	Settings runSettings;
+	vector<vector<string>> options;
+	for (size_t i = 0; i != settings.size(); ++i)
+	{
+		if (isSweepKey(settings[i].first))
+			continue;
+
+		runSettings.push_back(settings[i]);
+		options.push_back(split(settings[i].second, '|'));
+	}
+
+	// picks option choice[s] of every setting s
+	auto build = [&](const vector<size_t>& choice) {
+		RunConfig config;
+		for (size_t s = 0; s != runSettings.size(); ++s)
+			setOption(config, runSettings[s].first, options[s][choice[s]]);
+		return config;
+	};
+
+	vector<RunConfig> configs;
+	vector<size_t> choice(runSettings.size(), 0);
+	const string mode = findSetting(settings, "sweep", "grid");
+	if (mode == "grid")
+	{
+		// count through every combination like an odometer
+		while (true)
+		{
+			configs.push_back(build(choice));
+
+			size_t s = 0;
+			for (; s != choice.size(); ++s)
+			{
+				if (++choice[s] != options[s].size())
+					break;
+				choice[s] = 0;
+			}
+			if (s == choice.size())
+				break;
+		}
+	}
+	else if (mode == "random")
+	{
+		const size_t trials = parseSize("trials", findSetting(settings, "trials", "10"));
+		std::mt19937 generator(unsigned(parseSize("sweep_seed", findSetting(settings, "sweep_seed", "1"))));
+		for (size_t t = 0; t != trials; ++t)
+		{
+			for (size_t s = 0; s != choice.size(); ++s)
+				choice[s] = std::uniform_int_distribution<size_t>(0, options[s].size() - 1)(generator);
+			configs.push_back(build(choice));
+		}
+	}
+	else
+		throw std::invalid_argument("sweep must be grid or random, got '" + mode + "'");
+
+	return configs;
+}
+
+#endif // RUN_CONFIG_H
@@ -0,0 +1,144 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// FILE:        runner.cpp
+// DESCRIPTION: trains networks built from runtime settings instead of config.h,
+//              several configs are trained in parallel and compared
+//              usage: runner [--config file] [--key=value ...]
+// AUTHOR:      Dan Fabian
+// DATE:        10/20/2019
+
+#include "run_config.h"
+#include "network.h"
+#include <chrono>
+#include <thread>
+
+typedef std::chrono::steady_clock Clock;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// RUN RESULT
+struct RunResult {
+	double accuracy; // decimal of correct test answers / total
+	double seconds;  // wall time of training only
+	string error;    // set if the run threw instead
+};
+
+////////////////////////////////////////
+// fills X and Y with count samples whose answer is their input mod outputs,
+// the same task main.cpp trains on
+void makeData(const RunConfig& config, size_t count, std::mt19937& generator, valarray<ValD>& X, ValD& Y)
+{
+	std::uniform_int_distribution<size_t> distribution(0, config.inputs - 1);
+	X = valarray<ValD>(ValD(0.0, config.inputs), count);
+	Y = ValD(0.0, count);
+	for (size_t i = 0; i != count; ++i)
+	{
+		size_t ans = distribution(generator);
+		X[i][ans] = 1;
+		Y[i] = double(ans % config.outputs);
+	}
+}
+
+////////////////////////////////////////
+// builds, trains and tests the network described by config
+RunResult run(const RunConfig& config)
+{
+	std::mt19937 generator(config.seed);
+	valarray<ValD> Xtrain, Xtest;
+	ValD Ytrain, Ytest;
+	makeData(config, config.trainSize, generator, Xtrain, Ytrain);
+	makeData(config, config.testSize, generator, Xtest, Ytest);
+
+	Network net(config.layerSizes(), config.step, config.lambda);
+	net.setThreads(config.threads);
+	if (config.optimizer == "momentum")
+		net.setOptimizer(Momentum<double>());
+	else if (config.optimizer == "adam")
+		net.setOptimizer(Adam<double>());
+	if (config.softmax)
+		net.setOutput(SOFTMAX_OUTPUT);
+	for (size_t l = 1; l <= config.hidden.size(); ++l)
+		net.dropout(l, config.dropout);
+
+	Clock::time_point start = Clock::now();
+	net.train(Xtrain, Ytrain, config.epochs, config.batchSize);
+	RunResult result;
+	result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	result.accuracy = net.test(Xtest, Ytest, config.testSize);
+
+	return result;
+}
+
+////////////////////////////////////////
+// short description of the layers, e.g. 4-16-3
+string layersName(const RunConfig& config)
+{
+	vector<size_t> sizes = config.layerSizes();
+	string name = std::to_string(sizes[0]);
+	for (size_t l = 1; l != sizes.size(); ++l)
+		name += "-" + std::to_string(sizes[l]);
+
+	return name;
+}
+
+int main(int argc, char* argv[])
+{
+	// read settings and expand them into one config per run
+	Settings settings;
+	vector<RunConfig> configs;
+	size_t jobs = 0;
+	try
+	{
+		settings = parseArguments(argc, argv);
+		configs = expandSweep(settings);
+		jobs = parseSize("jobs", findSetting(settings, "jobs", "0"));
+	}
+	catch (const std::exception& e)
+	{
+		cout << "error: " << e.what() << endl
+			<< "usage: runner [--config file] [--key=value ...]" << endl
+			<< "keys: inputs outputs hidden step lambda epochs batch threads train_size test_size" << endl
+			<< "      output optimizer dropout seed, and sweep (grid|random) trials sweep_seed jobs" << endl
+			<< "separate options with | to sweep over them, e.g. --step='0.05|0.1' --hidden='8|16,16'" << endl;
+		return 1;
+	}
+	if (jobs == 0)
+		jobs = std::max(1u, std::thread::hardware_concurrency());
+
+	// train every config, jobs of them at a time
+	vector<RunResult> results(configs.size());
+	ThreadPool pool(std::min(jobs, configs.size()));
+	Clock::time_point start = Clock::now();
+	pool.run(configs.size(), [&](size_t i) {
+		try
+		{
+			results[i] = run(configs[i]);
+		}
+		catch (const std::exception& e)
+		{
+			results[i].error = e.what();
+		}
+	});
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	// report every run in config order, then the best one
+	cout << configs.size() << " runs on " << std::min(jobs, configs.size()) << " threads in " << seconds << " s" << endl << endl;
+	cout << "run\tlayers\toutput\tstep\tlambda\tepochs\tbatch\toptimizer\tdropout\taccuracy\ttime (s)" << endl;
+	size_t best = 0;
+	for (size_t i = 0; i != configs.size(); ++i)
+	{
+		const RunConfig& c = configs[i];
+		cout << i << '\t' << layersName(c) << '\t' << (c.softmax ? "softmax" : "sigmoid") << '\t' << c.step << '\t' << c.lambda << '\t' << c.epochs << '\t'
+			<< c.batchSize << '\t' << c.optimizer << "\t\t" << c.dropout << '\t';
+		if (results[i].error.empty())
+			cout << results[i].accuracy * 100.0 << "%\t\t" << results[i].seconds << endl;
+		else
+			cout << "error: " << results[i].error << endl;
+
+		if (results[i].error.empty() && (!results[best].error.empty() || results[i].accuracy > results[best].accuracy))
+			best = i;
+	}
+
+	if (!configs.empty() && results[best].error.empty())
+		cout << endl << "best run: " << best << " at " << results[best].accuracy * 100.0 << '%' << endl;
+}
@@ -0,0 +1,177 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// FILE:        thread_pool.h
+// DESCRIPTION: contains a small fixed size thread pool for data parallel loops
+// AUTHOR:      Dan Fabian
+// DATE:        10/20/2019
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using std::vector;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// THREAD POOL
+// notes: run() hands out task indices 0 .. tasks - 1 to the pool and blocks
+//        until every task is done, the calling thread works on tasks too so
+//        a pool of size 1 has no extra threads at all
+//        a run() that finds the pool busy with another caller's run() does
+//        all of its tasks on its own thread instead of waiting, so callers
+//        sharing a pool, such as concurrent predictions on one model, never
+//        queue behind each other
+//        a task that throws stops the tasks not yet handed out, run() waits
+//        for the ones already running and rethrows the first exception
+class ThreadPool {
+public:
+	// constructor and destructor
+	explicit ThreadPool(size_t threads);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// methods
+	void   run  (size_t tasks, const std::function<void(size_t)>& task); // runs task(i) for every i, returns when all are done
+	size_t size () const { return workers_.size() + 1; }                 // number of threads including the caller
+
+private:
+	// helper functions
+	void loop ();                                   // worker thread body
+	void work (std::unique_lock<std::mutex>& lock); // claims and runs tasks until none are left
+
+	vector<std::thread>                 workers_;
+	std::mutex                          mutex_;
+	std::mutex                          runMutex_;   // held by the run() the workers are helping
+	std::condition_variable             start_;
+	std::condition_variable             done_;
+	const std::function<void(size_t)>*  task_;
+	std::exception_ptr                  error_;      // first exception thrown by a task of the current run
+	size_t                              tasks_;      // total tasks in current run
+	size_t                              next_;       // next task index to hand out
+	size_t                              remaining_;  // tasks not yet finished
+	size_t                              generation_; // bumped on every run so workers notice new work
+	bool                                stop_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// THREAD POOL functions
+////////////////////////////////////////
+// constructor, spawns threads - 1 workers since the caller also works
+ThreadPool::ThreadPool(size_t threads) :
+	task_(nullptr),
+	tasks_(0),
+	next_(0),
+	remaining_(0),
+	generation_(0),
+	stop_(false)
+{
+	for (size_t i = 1; i < threads; ++i)
+		workers_.emplace_back(&ThreadPool::loop, this);
+}
+
+////////////////////////////////////////
+// destructor, wakes and joins all workers
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	start_.notify_all();
+
+	for (size_t i = 0; i != workers_.size(); ++i)
+		workers_[i].join();
+}
+
+////////////////////////////////////////
+// runs task(i) for i in [0, tasks) across the pool and waits for all of them
+void ThreadPool::run(size_t tasks, const std::function<void(size_t)>& task)
+{
+	if (tasks == 0)
+		return;
+
+	// a single task, no workers or a busy pool all run on the calling thread
+	std::unique_lock<std::mutex> runLock(runMutex_, std::defer_lock);
+	if (tasks == 1 || workers_.empty() || !runLock.try_lock())
+	{
+		for (size_t i = 0; i != tasks; ++i)
+			task(i);
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	task_ = &task;
+	tasks_ = remaining_ = tasks;
+	next_ = 0;
+	++generation_;
+	start_.notify_all();
+
+	// help out, then wait for the stragglers
+	work(lock);
+	done_.wait(lock, [this] { return remaining_ == 0; });
+	task_ = nullptr;
+
+	if (error_)
+	{
+		std::exception_ptr error = error_;
+		error_ = nullptr;
+		lock.unlock();
+		std::rethrow_exception(error);
+	}
+}
+
+////////////////////////////////////////
+// claims and runs tasks until none are left, lock is held on entry and exit,
+// an exception is kept for run() and the unclaimed tasks are dropped
+void ThreadPool::work(std::unique_lock<std::mutex>& lock)
+{
+	while (task_ && next_ < tasks_)
+	{
+		size_t index = next_++;
+		const std::function<void(size_t)>& task = *task_;
+
+		std::exception_ptr error;
+		lock.unlock();
+		try { task(index); }
+		catch (...) { error = std::current_exception(); }
+		lock.lock();
+
+		if (error)
+		{
+			if (!error_)
+				error_ = error;
+			remaining_ -= tasks_ - next_;
+			next_ = tasks_;
+		}
+		if (--remaining_ == 0)
+			done_.notify_all();
+	}
+}
+
+////////////////////////////////////////
+// worker thread body
+void ThreadPool::loop()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	size_t seen = generation_;
+	while (true)
+	{
+		start_.wait(lock, [&] { return stop_ || generation_ != seen; });
+		if (stop_)
+			return;
+
+		seen = generation_;
+		work(lock);
+	}
+}
+
+#endif // THREAD_POOL_H